@@ -5,10 +5,14 @@
 
 #include <iostream>
 #include <algorithm>
+#include <cmath>
+#include <map>
+#include <pthread.h>
 
 #include "MyDefine.h"
 #include "Fragment.h"
 #include "Amplicon.h"
+#include "Arena.h"
 
 AmpError::AmpError(unsigned char etype, unsigned int pos, unsigned char alt) {
 	data[0] = (etype << 6) | ((pos >> 21) & 0x0000003F);
@@ -17,6 +21,79 @@ AmpError::AmpError(unsigned char etype, unsigned int pos, unsigned char alt) {
 	data[3] = ((pos & 0x0000001F) << 3) | alt;
 }
 
+// error lists of amplicons, one arena per thread, all freed at once
+static vector<Arena*> errorArenas;
+static pthread_mutex_t errorArenaLock = PTHREAD_MUTEX_INITIALIZER;
+
+static Arena& getErrorArena() {
+	static thread_local Arena *arena = NULL;
+	if(arena == NULL) {
+		arena = new Arena();
+		pthread_mutex_lock(&errorArenaLock);
+		errorArenas.push_back(arena);
+		pthread_mutex_unlock(&errorArenaLock);
+	}
+	return *arena;
+}
+
+void releaseAmpErrors() {
+	pthread_mutex_lock(&errorArenaLock);
+	for(size_t i = 0; i < errorArenas.size(); i++) {
+		errorArenas[i]->release();
+	}
+	pthread_mutex_unlock(&errorArenaLock);
+}
+
+Arena& getScratchArena() {
+	static thread_local Arena arena;
+	return arena;
+}
+
+//****** place substitutions on bases [8, ampliconLen) of seq, returns NULL if there is none ******//
+AmpError* createAmpErrors(const char *seq, unsigned int ampliconLen, double ber, int& gcNum) {
+	static string bases = config.getStringPara("bases");
+	static thread_local vector<AmpError> errs;
+	unsigned int j, n;
+	
+	if(ber <= 0) {
+		return NULL;
+	}
+	//jump to the next error with a geometric gap instead of testing every base
+	double lq = (ber < 1)? log(1-ber) : 0;
+	errs.clear();
+	j = 8;
+	while(j < ampliconLen) {
+		if(ber < 1) {
+			double skip = log(randomDouble(ZERO_FINAL, 1))/lq;
+			if(skip >= ampliconLen-j) {
+				break;
+			}
+			j += (unsigned int) skip;
+		}
+		char base = seq[j];
+		do {
+			n = randomInteger(0, bases.size());
+		} while(bases[n] == base);
+		
+		if(bases[n] == 'C' || bases[n] == 'G') {
+			gcNum++;
+		}
+		if(base == 'C' || base == 'G') {
+			gcNum--;
+		}
+		errs.push_back(AmpError(1, j, n));
+		j++;
+	}
+	
+	if(errs.empty()) {
+		return NULL;
+	}
+	AmpError *ampErrs = getErrorArena().allocate<AmpError>(errs.size()+1);
+	memcpy(ampErrs, &errs[0], errs.size()*sizeof(AmpError));
+	ampErrs[errs.size()].setAlt(bases.size());
+	return ampErrs;
+}
+
 unsigned char AmpError::getErrType() {
 	return data[0] >> 6;
 }
@@ -62,8 +139,8 @@ Amplicon::Amplicon(bool isSemi, void *tmpl, AmpError *ampErrs, unsigned int star
 	this->sequence = NULL;
 }
 
+// the error list belongs to the error arenas and is freed by releaseAmpErrors
 void Amplicon::clear() {
-	delete[] ampErrs;
 	delete[] sequence;
 	ampErrs = NULL;
 	sequence = NULL;
@@ -153,8 +230,8 @@ void Amplicon::setData(unsigned int n) {
 	}
 }
 
-void Amplicon::amplify(AmpliconLink& results, AmpliconLink source) {
-	unsigned int i, j, k, n;
+void Amplicon::amplify(AmpliconStore& results) {
+	unsigned int i, j;
 	unsigned int spos, ampliconLen;
 	double ber = config.getRealPara("ber");
 	string bases = config.getStringPara("bases");
@@ -167,28 +244,26 @@ void Amplicon::amplify(AmpliconLink& results, AmpliconLink source) {
 		return;
 	}
 	
-	char* semiAmpSeq = getSequence();
-	char* semiAmpSeq_c = getComplementSeq(semiAmpSeq);
-	//char* semiAmpSeq_c = semiAmpSeq;
-	short int* posAttached = new short int[length];
-	memset(posAttached, 0, length*sizeof(unsigned short int));
+	Arena& scratch = getScratchArena();
+	char* semiAmpSeq_c = getSequence(NULL, scratch.allocate<char>(length+1));
+	getComplementSeq(semiAmpSeq_c);
+	//one bit for every position a primer is attached to
+	unsigned long* posAttached = scratch.allocate<unsigned long>(length/64+1);
+	memset(posAttached, 0, (length/64+1)*sizeof(unsigned long));
 
 	for(i = 0; i < primerNum; i++) {
 		int tryTimes = 0;
 		do {
-			spos = threadPool->randomInteger(27, length);
-			ampliconLen = threadPool->randomDouble(minLen, maxLen+1);
+			spos = randomInteger(27, length);
+			ampliconLen = randomDouble(minLen, maxLen+1);
 			tryTimes++;
 			if(tryTimes > 50) {
 				break;
 			}
-			if(spos+ampliconLen > length || posAttached[spos] == 1) {
+			if(spos+ampliconLen > length || ((posAttached[spos/64] >> (spos%64)) & 1)) {
 				continue;
 			}
-			char c = semiAmpSeq_c[spos+8];
-			semiAmpSeq_c[spos+8] = '\0';
 			j = malbac.updatePrimerCount(&semiAmpSeq_c[spos], -1);
-			semiAmpSeq_c[spos+8] = c;
 			if(j == 1) {
 				break;
 			}
@@ -197,200 +272,174 @@ void Amplicon::amplify(AmpliconLink& results, AmpliconLink source) {
 			break;
 		}
 		
-		posAttached[spos] = 1;
+		posAttached[spos/64] |= 1UL << (spos%64);
 		
 		char c = semiAmpSeq_c[spos+ampliconLen];
 		semiAmpSeq_c[spos+ampliconLen] = '\0';
 		int gcNum = countGC(semiAmpSeq_c+spos);
 		semiAmpSeq_c[spos+ampliconLen] = c;
 		
-		vector<AmpError> errs;
-		for(j = 8; j < ampliconLen; j++) {
-			double p = threadPool->randomDouble(0, 1);
-			if(p < ber) {
-				char base = semiAmpSeq_c[spos+j];
-				do {
-					n = threadPool->randomDouble(0, bases.size());
-				} while(bases[n] == base);
-				
-				if(bases[n] == 'C' || bases[n] == 'G') {
-					gcNum++;
-				}
-				if(base == 'C' || base == 'G') {
-					gcNum--;
-				}
-				AmpError ampErr(1, j, n);
-				errs.push_back(ampErr);
-			}
-		}
-		AmpError *ampErrs = NULL;
-		if(!errs.empty()) {
-			ampErrs = new AmpError[errs.size()+1];
-			for(j = 0; j < errs.size(); j++) {
-				memcpy(ampErrs[j].getData(), errs[j].getData(), 4);
-			}
-			ampErrs[j].setAlt(bases.size());
-		}
-		Amplicon tmp(false, source, ampErrs, spos, ampliconLen, max(0, gcNum));
-		insertLinkList(results, tmp);
+		AmpError *ampErrs = createAmpErrors(semiAmpSeq_c+spos, ampliconLen, ber, gcNum);
+		Amplicon tmp(false, this, ampErrs, spos, ampliconLen, max(0, gcNum));
+		results.push_back(tmp);
 	}
-	
-	delete[] semiAmpSeq_c;
-	delete[] posAttached;
 }
 
 void* Amplicon::batchAmplify(const void* args) {
-	AmpliconLink* pNodeRange = (AmpliconLink*) args;
-	AmpliconLink p = pNodeRange[0];
+	AmplifyTask* task = (AmplifyTask*) args;
+	unsigned long i;
+	AmpliconStore& semiAmplicons = malbac.getSemiAmplicons();
 	
-	AmpliconLink results = createNullLink();
-	while(p != pNodeRange[1]) {
-		p->amplicon.amplify(results, p);
-		p = p->link;
+	for(i = task->begin; i < task->end; i++) {
+		localRandomEngine.setStream(STAGE_SEMI_AMPLIFY, i, task->cycle);
+		getScratchArena().reset();
+		semiAmplicons[i].amplify(task->products);
 	}
-	
-	malbac.extendFullAmplicons(results);
+	return NULL;
 }
 
-char* Amplicon::getSequence() {
-	/*
-	if(sequence != NULL) {
-		return sequence;
-	}
-	*/
-	unsigned int i, j, k;
-	unsigned int n, m, sindx;
-	unsigned int semiLength, length;
-	unsigned int spos;
-	string bases = config.getStringPara("bases");
-	if(!isSemi()) {
-		AmpliconLink p = (AmpliconLink) tmpl;
-		Amplicon& semiAmp = p->amplicon;
-		Fragment* frag = (Fragment*) (semiAmp.tmpl);
-		//frag.describe();
-		char* fragSeq = frag->getSequence();
-		char* semiSeq_o = new char[strlen(fragSeq)+1];
-		strcpy(semiSeq_o, fragSeq);
-		semiSeq_o = getComplementSeq(semiSeq_o);
-		
-		AmpError* errs = semiAmp.getErrs();
-		semiLength = semiAmp.getLength();
-		char* semiSeq = new char[semiLength+1];
-		semiSeq[semiLength] = '\0';
-		sindx = 0;
-		spos = semiAmp.getStartPos();
-		m = spos;
-		if(errs) {
-			k = errs->getAlt();
-			while(k != bases.size()) {
-				j = errs->getPos();
-				while(m < j+spos) {
-					semiSeq[sindx++] = semiSeq_o[m++];
-				}
-				if(errs->getErrType() == 0) {
-					m++;
-				}
-				else {
-					semiSeq_o[j+spos] = bases[k];
-				}
-				errs++;
-				k = errs->getAlt();
-			}			
+//****** number of template bases consumed by an amplicon of the given length ******//
+static unsigned int getTemplateSpan(AmpError *errs, unsigned int length) {
+	static string bases = config.getStringPara("bases");
+	unsigned int span = length;
+	if(errs) {
+		for(; errs->getAlt() != bases.size(); errs++) {
+			span += (errs->getErrType() == 0);
 		}
-		while(sindx < semiLength) {
-			semiSeq[sindx++] = semiSeq_o[m++];
-		}
-		delete[] semiSeq_o;
-		
-		// convert to 3'->5'
-		reverse(semiSeq, semiSeq+strlen(semiSeq));
-		
-		char* fullSeq = getComplementSeq(semiSeq);
-		
-		length = getLength();
-		char* ret = new char[length+1];
-		ret[length] = '\0';
-		sindx = 0;
-		spos = getStartPos();
-		m = spos;
-		errs = ampErrs;
-		if(errs) {
+	}
+	return span;
+}
+
+//****** copy length bases of the template window to out, applying the errors of the amplicon ******//
+// the window starts at the start position of the amplicon and is changed in place by substitutions
+static void applyAmpErrors(char *window, unsigned int length, AmpError *errs, char *out) {
+	static string bases = config.getStringPara("bases");
+	unsigned int j, k, m = 0, sindx = 0;
+	if(errs) {
+		k = errs->getAlt();
+		while(k != bases.size()) {
+			j = errs->getPos();
+			while(m < j) {
+				out[sindx++] = window[m++];
+			}
+			if(errs->getErrType() == 0) {
+				m++;
+			}
+			else {
+				window[j] = bases[k];
+			}
+			errs++;
 			k = errs->getAlt();
-			while(k != bases.size()) {
-				j = errs->getPos();
-				while(m < j+spos) {
-					ret[sindx++] = fullSeq[m++];
-				}
-				if(errs->getErrType() == 0) {
-					m++;
-				}
-				else {
-					fullSeq[j+spos] = bases[k];
-				}
-				errs++;
-				k = errs->getAlt();
-			}			
 		}
-		while(sindx < length) {
-			ret[sindx++] = fullSeq[m++];
-		}
-		delete[] fullSeq;
-		
-		return ret;
+	}
+	while(sindx < length) {
+		out[sindx++] = window[m++];
+	}
+	out[length] = '\0';
+}
+
+// complemented sequences of semi amplicons, kept while full amplicons copied from them are materialized
+struct TemplateEntry {
+	char *seq;
+	int refs;
+};
+static map<Amplicon*, TemplateEntry> templateCache;
+static pthread_mutex_t templateLock = PTHREAD_MUTEX_INITIALIZER;
+
+const char* Amplicon::acquireTemplate(Amplicon *semiAmp) {
+	map<Amplicon*, TemplateEntry>::iterator it;
+	pthread_mutex_lock(&templateLock);
+	it = templateCache.find(semiAmp);
+	if(it != templateCache.end()) {
+		it->second.refs++;
+		pthread_mutex_unlock(&templateLock);
+		return it->second.seq;
+	}
+	pthread_mutex_unlock(&templateLock);
+	
+	//built outside the lock, a copy built meanwhile by another thread wins
+	char *seq = semiAmp->getSequence();
+	getComplementSeq(seq);
+	pthread_mutex_lock(&templateLock);
+	it = templateCache.find(semiAmp);
+	if(it != templateCache.end()) {
+		it->second.refs++;
+		delete[] seq;
+		seq = it->second.seq;
 	}
 	else {
+		TemplateEntry entry = {seq, 1};
+		templateCache[semiAmp] = entry;
+	}
+	pthread_mutex_unlock(&templateLock);
+	return seq;
+}
+
+void Amplicon::releaseTemplate(Amplicon *semiAmp) {
+	char *seq = NULL;
+	pthread_mutex_lock(&templateLock);
+	map<Amplicon*, TemplateEntry>::iterator it = templateCache.find(semiAmp);
+	if(it != templateCache.end() && --it->second.refs == 0) {
+		seq = it->second.seq;
+		templateCache.erase(it);
+	}
+	pthread_mutex_unlock(&templateLock);
+	delete[] seq;
+}
+
+//****** write the sequence of the amplicon to out, which holds getLength()+1 chars ******//
+// only the template window of the amplicon is materialized, tmplSeq is the template of a full amplicon
+// given by acquireTemplate and is not used for semi amplicons
+char* Amplicon::getSequence(const char *tmplSeq, char *out) {
+	static thread_local vector<char> window;
+	unsigned int length = getLength();
+	unsigned int spos = getStartPos();
+	unsigned int span = getTemplateSpan(ampErrs, length);
+	unsigned long n, tmplLen;
+	
+	//bases past the end of the template read as '\0'
+	window.assign(span+1, '\0');
+	if(isSemi()) {
 		Fragment *frag = (Fragment*) tmpl;
-		char* fragSeq = frag->getSequence();
-		char* semiSeq_o = new char[strlen(fragSeq)+1];
-		strcpy(semiSeq_o, fragSeq);
-		semiSeq_o = getComplementSeq(semiSeq_o);
-		
-		length = getLength();
-		char* ret = new char[length+1];
-		ret[length] = '\0';
-		sindx = 0;
-		spos = getStartPos();
-		m = spos;
-		AmpError* errs = ampErrs;
-		
-		if(errs) {
-			k = errs->getAlt();
-			while(k != bases.size()) {
-				j = errs->getPos();
-				while(m < j+spos) {
-					ret[sindx++] = semiSeq_o[m++];
-				}
-				if(errs->getErrType() == 0) {
-					m++;
-				}
-				else {
-					semiSeq_o[j+spos] = bases[k];
-				}
-				errs++;
-				k = errs->getAlt();
-			}
-		}
-		while(sindx < length) {
-			ret[sindx++] = semiSeq_o[m++];
-		}
-		delete[] semiSeq_o;
-		
+		tmplLen = frag->getLength();
+		n = (spos < tmplLen)? min((unsigned long) span, tmplLen-spos) : 0;
+		frag->decode(spos, n, &window[0], true);
+	}
+	else {
+		tmplLen = ((Amplicon*) tmpl)->getLength();
+		n = (spos < tmplLen)? min((unsigned long) span, tmplLen-spos) : 0;
+		memcpy(&window[0], tmplSeq+spos, n);
+	}
+	applyAmpErrors(&window[0], length, ampErrs, out);
+	
+	if(isSemi()) {
 		// convert to 3'->5'
-		reverse(ret, ret+strlen(ret));
-		return ret;
-	}	
+		reverse(out, out+strlen(out));
+	}
+	return out;
+}
+
+char* Amplicon::getSequence() {
+	char *ret = new char[getLength()+1];
+	if(isSemi()) {
+		return getSequence(NULL, ret);
+	}
+	Amplicon *semiAmp = (Amplicon*) tmpl;
+	getSequence(acquireTemplate(semiAmp), ret);
+	releaseTemplate(semiAmp);
+	return ret;
 }
 
 void* Amplicon::batchGetSequences(const void* args) {
-	AmpliconLink* pNodeRange = (AmpliconLink*) args;
-	AmpliconLink p = pNodeRange[0];
+	unsigned long* indexs = (unsigned long*) args;
+	unsigned long i;
+	AmpliconStore& fullAmplicons = malbac.getFullAmplicons();
 	
-	AmpliconLink results = createNullLink();
-	while(p != pNodeRange[1]) {
-		char *seq = p->amplicon.getSequence();
-		p->amplicon.setSequence(seq);
-		p = p->link;
+	for(i = indexs[0]; i <= indexs[1]; i++) {
+		char *seq = fullAmplicons[i].getSequence();
+		fullAmplicons[i].setSequence(seq);
 	}
+	return NULL;
 }
 
 double Amplicon::getWeightedLength() {
@@ -399,198 +448,171 @@ double Amplicon::getWeightedLength() {
 	return profile.getGCFactor(gc)*(getLength())/(fragSize*fragSize);
 }
 
+// reads of one amplicon are simulated in batches of this size
+static const int READ_BATCH = 256;
+
 void* Amplicon::yieldReads(const void* args) {
-	AmpliconLink* pNodeRange = (AmpliconLink*) args;
-	AmpliconLink p = pNodeRange[0];
-	AmpliconLink fullAmplicons = malbac.getFullAmplicons();
-	int j, k, n, fragCount, failCount, seqLen;
+	AmpliconRange* range = (AmpliconRange*) args;
+	AmpliconStore& fullAmplicons = malbac.getFullAmplicons();
+	int j, n, num, fragCount, failCount, insertSize;
 	unsigned int* readNumbers = malbac.getReadNumbers();
 	
-	char *seq, *ampliconSeq, *fragSeq;
+	Amplicon *semiAmp = NULL;
+	const char *tmplSeq = NULL;
+	char *ampliconSeq = new char[config.getIntPara("ampliconMaxLen")+1];
 	bool paired = config.isPairedEnd();
 	int ampliconLen, readLength = config.getIntPara("readLength");
+	//insertions that would make a read longer than maxLen are dropped
+	int maxLen = 2*readLength;
 	
-	unsigned long bufferSize = 50000000;
-	char buf[10*readLength], buf1[10*readLength], buf2[10*readLength];
-	char *results;
-	char *outBuffer, *outBuffer1, *outBuffer2;
-	unsigned long outIndx = 0, outIndx1 = 0, outIndx2 = 0;
-	if(paired) {
-		outBuffer1 = new char[bufferSize];
-		outBuffer2 = new char[bufferSize];
-	}
-	else {
-		outBuffer = new char[bufferSize];
-	}
+	//output goes to pooled buffers of the writer, numbered by task and chunk,
+	//interleaved output keeps both mates of a pair in the same buffer
+	unsigned long recordSize = 2*maxLen+64;
+	SeqWriter *writer = range->writer;
+	int mateSide = paired? writer->mateSide() : 0;
+	unsigned long pairSize = (mateSide == 0 && paired)? 2*recordSize : recordSize;
+	unsigned long chunk = 0;
+	//the first buffer is taken before any read is simulated: from then on the writer counts the task
+	//as running and lets later tasks wait for it, before that they allocate past the buffer limit,
+	//so the ordered output cannot deadlock whatever order the pool runs the tasks in
+	SeqBuffer *outBuffer = writer->getBuffer(range->task, chunk++);
 	
-	AmpliconLink q = fullAmplicons->link->link;
-	unsigned long i = 0;
-	while(q != p) {
-		q = q->link;
-		i++;
-	}
+	//reads of the current batch, mate 2 is read from a reverse complement view of its window
+	long starts1[READ_BATCH], starts2[READ_BATCH];
+	int lens1[READ_BATCH], lens2[READ_BATCH], fragIndxs[READ_BATCH];
+	char *reads1 = new char[2*READ_BATCH*maxLen];
+	char *reads2 = paired? new char[2*READ_BATCH*maxLen] : NULL;
+	
+	unsigned long i, readIndx = range->base;
 	
 	long pos;
-	while(p != pNodeRange[1]) {
-		n = readNumbers[i++];
+	for(i = range->begin; i < range->end; i++) {
+		Amplicon& amplicon = fullAmplicons[i];
+		n = readNumbers[readIndx++];
 		if(n == 0) {
-			p = p->link;
 			continue;
 		}
-		ampliconSeq = p->amplicon.getSequence();
+		localRandomEngine.setStream(STAGE_READS, i, 0);
+		//full amplicons of a semi amplicon are consecutive, its sequence is kept until the next one
+		if(amplicon.getTmpl() != semiAmp) {
+			if(semiAmp != NULL) {
+				releaseTemplate(semiAmp);
+			}
+			semiAmp = (Amplicon*) amplicon.getTmpl();
+			tmplSeq = acquireTemplate(semiAmp);
+		}
+		amplicon.getSequence(tmplSeq, ampliconSeq);
 		ampliconLen = strlen(ampliconSeq);
 		if(ampliconLen < readLength) {
-			delete[] ampliconSeq;
-			p = p->link;
 			continue;
 		}
-		
 		fragCount = 0;
 		failCount = 0;
 		while(n > 0) {
-			fragCount++;
+			num = 0;
 			if(!paired) {
-				pos = threadPool->randomInteger(0, ampliconLen-readLength+1);
-				char c = ampliconSeq[pos+readLength];
-				ampliconSeq[pos+readLength] = '\0';
-				results = profile.predict(&ampliconSeq[pos], 1);
-				ampliconSeq[pos+readLength] = c;
-				
-				k = 0;
-				sprintf(&buf[k], "@%d#%d\n", i-1, fragCount);
-				k = strlen(buf);
-				seqLen = strlen(results)/2;
-				strncpy(&buf[k], &results[0], seqLen);
-				strcpy(&buf[k+seqLen], "\n+\n");
-				strncpy(&buf[k+seqLen+3], &results[seqLen], seqLen);
-				buf[k+2*seqLen+3] = '\n';
-				buf[k+2*seqLen+4] = '\0';
-				delete[] results;
-				
-				if(strlen(buf)+outIndx < bufferSize) {
-					strcpy(&outBuffer[outIndx], buf);
-					outIndx += strlen(buf);
+				while(n > 0 && num < READ_BATCH) {
+					fragIndxs[num] = ++fragCount;
+					starts1[num++] = randomInteger(0, ampliconLen-readLength+1);
+					n--;
 				}
-				else {
-					swp->write(outBuffer);
-					strcpy(outBuffer, buf);
-					outIndx = strlen(buf);
-				}
-				
-				n--;
 			}
 			else {
-				int insertSize = profile.yieldInsertSize();
-				if(insertSize < readLength || insertSize > ampliconLen) {
-					failCount++;
-					if(failCount > 1000) {
-						break;
+				while(n > 0 && num < READ_BATCH) {
+					fragCount++;
+					insertSize = profile.yieldInsertSize();
+					if(insertSize < readLength || insertSize > ampliconLen) {
+						failCount++;
+						if(failCount > 1000) {
+							n = 0;
+						}
+						continue;
 					}
-					continue;
+					pos = randomInteger(0, ampliconLen-insertSize+1);
+					fragIndxs[num] = fragCount;
+					starts1[num] = pos;
+					starts2[num++] = pos+insertSize-readLength;
+					n -= 2;
+				}
+			}
+			
+			profile.predict(ampliconSeq, starts1, num, readLength, maxLen, 1, false, reads1, lens1);
+			if(paired) {
+				profile.predict(ampliconSeq, starts2, num, readLength, maxLen, 0, true, reads2, lens2);
+			}
+			
+			for(j = 0; j < num; j++) {
+				if(outBuffer->space(0) < pairSize || (mateSide > 0 && outBuffer->space(1) < recordSize)) {
+					writer->submit(outBuffer, false);
+					outBuffer = writer->getBuffer(range->task, chunk++);
 				}
-				pos = threadPool->randomInteger(0, ampliconLen-insertSize+1);
-				char c = ampliconSeq[pos+readLength];
-				ampliconSeq[pos+readLength] = '\0';
-				results = profile.predict(&ampliconSeq[pos], 1);
-				ampliconSeq[pos+readLength] = c;
-				
-				k = 0;
-				sprintf(&buf1[k], "@%d#%d/1\n", i-1, fragCount);
-				k = strlen(buf1);
-				seqLen = strlen(results)/2;
-				strncpy(&buf1[k], &results[0], seqLen);
-				strcpy(&buf1[k+seqLen], "\n+\n");
-				strncpy(&buf1[k+seqLen+3], &results[seqLen], seqLen);
-				buf1[k+2*seqLen+3] = '\n';
-				buf1[k+2*seqLen+4] = '\0';
-				delete[] results;
-				
-				char* seq = &ampliconSeq[pos+insertSize-readLength];
-				c = ampliconSeq[pos+insertSize];
-				ampliconSeq[pos+insertSize] = '\0';
-				seq = getComplementSeq(seq);
-				reverse(seq, seq+readLength);
-				results = profile.predict(seq, 0);
-				reverse(seq, seq+readLength);
-				getComplementSeq(seq);
-				ampliconSeq[pos+insertSize] = c;
-				
-				k = 0;
-				sprintf(&buf2[k], "@%d#%d/2\n", i-1, fragCount);
-				k = strlen(buf2);
-				seqLen = strlen(results)/2;
-				strncpy(&buf2[k], &results[0], seqLen);
-				strcpy(&buf2[k+seqLen], "\n+\n");
-				strncpy(&buf2[k+seqLen+3], &results[seqLen], seqLen);
-				buf2[k+2*seqLen+3] = '\n';
-				buf2[k+2*seqLen+4] = '\0';
-				delete[] results;
-				
-				if(strlen(buf1)+outIndx1 < bufferSize && strlen(buf2)+outIndx2 < bufferSize) {
-					strcpy(&outBuffer1[outIndx1], buf1);
-					strcpy(&outBuffer2[outIndx2], buf2);
-					outIndx1 += strlen(buf1);
-					outIndx2 += strlen(buf2);
+				char *read1 = &reads1[2*j*maxLen];
+				if(!paired) {
+					outBuffer->appendRecord(0, i, fragIndxs[j], 0, read1, read1+maxLen, lens1[j]);
 				}
 				else {
-					swp->write(outBuffer1, outBuffer2);
-					strcpy(outBuffer1, buf1);
-					strcpy(outBuffer2, buf2);
-					outIndx1 = strlen(buf1);
-					outIndx2 = strlen(buf2);
+					char *read2 = &reads2[2*j*maxLen];
+					outBuffer->appendRecord(0, i, fragIndxs[j], 1, read1, read1+maxLen, lens1[j]);
+					outBuffer->appendRecord(mateSide, i, fragIndxs[j], 2, read2, read2+maxLen, lens2[j]);
 				}
-				
-				n -= 2;
 			}
 		}
-		delete[] ampliconSeq;
-		p = p->link;	
 	}
+	if(semiAmp != NULL) {
+		releaseTemplate(semiAmp);
+	}
+	delete[] ampliconSeq;
+	
+	writer->submit(outBuffer, true);
 	
 	if(paired) {
-		if(strlen(outBuffer1) > 0) {
-			swp->write(outBuffer1, outBuffer2);
-		}
-		delete[] outBuffer1;
-		delete[] outBuffer2;
-	}
-	else {
-		if(strlen(outBuffer) > 0) {
-			swp->write(outBuffer);
-		}
-		delete[] outBuffer;
+		delete[] reads2;
 	}
+	delete[] reads1;
 	
 	return NULL;
 }
 
-AmpliconLink createNullLink() {
-	AmpliconLink p = (AmpliconLink) malloc(sizeof(AmpliconNode));
-	p->amplicon.setData(0);
-	p->link = p;
-	return p;
+void AmpliconStore::push_back(Amplicon& amplicon) {
+	if((count & CHUNK_MASK) == 0) {
+		Amplicon* chunk = (Amplicon*) malloc(CHUNK_SIZE*sizeof(Amplicon));
+		chunks.push_back(chunk);
+	}
+	chunks.back()[count & CHUNK_MASK] = amplicon;
+	count++;
 }
 
-void insertLinkList(AmpliconLink& linkList, Amplicon& amplicon) {
-	AmpliconLink p = (AmpliconLink) malloc(sizeof(AmpliconNode));
-	p->amplicon = amplicon;
-	AmpliconLink q = linkList->link->link;
-	linkList->link->link = p;
-	p->link = q;
-	if(linkList->link == p) {
-		linkList = p;
+void AmpliconStore::splice(AmpliconStore& other) {
+	if(other.count == 0) {
+		return;
+	}
+	// the amplicons of other keep their order after ours, chunks are moved as a whole
+	// when ours end on a chunk boundary, otherwise they are copied into the following slots
+	if((count & CHUNK_MASK) == 0) {
+		chunks.insert(chunks.end(), other.chunks.begin(), other.chunks.end());
+		count += other.count;
+		other.chunks.clear();
+		other.count = 0;
+		return;
 	}
-	Amplicon& amp = linkList->link->amplicon;
-	amp.setData(amp.getData()+1);
+	unsigned long i = 0, n;
+	while(i < other.count) {
+		if((count & CHUNK_MASK) == 0) {
+			chunks.push_back((Amplicon*) malloc(CHUNK_SIZE*sizeof(Amplicon)));
+		}
+		n = min(CHUNK_SIZE-(count & CHUNK_MASK), CHUNK_SIZE-(i & CHUNK_MASK));
+		n = min(n, other.count-i);
+		memcpy(chunks.back()+(count & CHUNK_MASK), other.chunks[i >> CHUNK_BITS]+(i & CHUNK_MASK), n*sizeof(Amplicon));
+		count += n;
+		i += n;
+	}
+	other.clear();
 }
 
-void printLinkList(AmpliconLink linkList) {
-	AmpliconLink p = linkList->link->link;
-	unsigned int i = 1;
-	while(p != linkList->link) {
-		cerr << i++ << '\t';
-		p = p->link;
+void AmpliconStore::clear() {
+	for(unsigned long i = 0; i < chunks.size(); i++) {
+		free(chunks[i]);
 	}
-	cerr << endl;
+	chunks.clear();
+	count = 0;
 }
-
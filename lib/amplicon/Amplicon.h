@@ -12,8 +12,7 @@
 
 using namespace std;
 
-struct AmpliconNode;
-typedef AmpliconNode * AmpliconLink;
+class AmpliconStore;
 
 //enum errorType {Del, Base_substitution};
 
@@ -31,6 +30,14 @@ class AmpError {
 		unsigned char* getData() {return data;}
 };
 
+class Arena;
+
+AmpError* createAmpErrors(const char *seq, unsigned int ampliconLen, double ber, int& gcNum);
+//free the error lists of all amplicons, they live until the reads are written
+void releaseAmpErrors();
+//per-thread scratch for the transient buffers of amplifying one template, reset before every template
+Arena& getScratchArena();
+
 
 class Amplicon {
 	private:
@@ -61,25 +68,66 @@ class Amplicon {
 		void setErrs(AmpError *ampErrs) {this->ampErrs = ampErrs;}
 		void setSequence(char *seq) {sequence = seq;}
 		char* getSequence();
+		char* getSequence(const char *tmplSeq, char *out);
+		//complemented sequence of a semi amplicon shared by the full amplicons copied from it,
+		//every acquire is paired with a release
+		static const char* acquireTemplate(Amplicon *semiAmp);
+		static void releaseTemplate(Amplicon *semiAmp);
 		static void* batchGetSequences(const void* args);
 		
-		void amplify(AmpliconLink& results, AmpliconLink source);
+		void amplify(AmpliconStore& results);
 		static void* batchAmplify(const void* args);
 		
 		double getWeightedLength();
 		static void* yieldReads(const void* args);
 };
 
-struct AmpliconNode {
-	Amplicon amplicon;
-	struct AmpliconNode *link;
-};
+class SeqWriter;
 
-AmpliconLink createNullLink();
+// amplicons [begin, end) producing reads, base is the offset of begin in readNumbers,
+// written as task of the given writer, tasks number the ranges in the output order
+struct AmpliconRange {
+	unsigned long begin;
+	unsigned long end;
+	unsigned long base;
+	unsigned long task;
+	SeqWriter *writer;
+};
 
-void insertLinkList(AmpliconLink& linkList, Amplicon& amplicon);
+// chunked amplicon storage addressed by index, chunks are handed between stores without copying
+class AmpliconStore {
+	private:
+		static const unsigned int CHUNK_BITS = 14;
+		static const unsigned long CHUNK_SIZE = 1UL << CHUNK_BITS;
+		static const unsigned long CHUNK_MASK = CHUNK_SIZE-1;
+		
+		vector<Amplicon*> chunks;
+		unsigned long count;
+		
+		AmpliconStore(const AmpliconStore&);
+		AmpliconStore& operator=(const AmpliconStore&);
+		
+	public:
+		AmpliconStore() {count = 0;}
+		~AmpliconStore() {clear();}
+		
+		unsigned long size() {return count;}
+		bool empty() {return count == 0;}
+		Amplicon& operator[](unsigned long i) {return chunks[i >> CHUNK_BITS][i & CHUNK_MASK];}
+		
+		void push_back(Amplicon& amplicon);
+		void splice(AmpliconStore& other);
+		void clear();
+};
 
-void printLinkList(AmpliconLink linkList);
+// templates [begin, end) amplified by one task in the given cycle,
+// products of all tasks are merged in task order after the pool finishes
+struct AmplifyTask {
+	unsigned long begin;
+	unsigned long end;
+	int cycle;
+	AmpliconStore products;
+};
 
 #endif
 
@@ -0,0 +1,67 @@
+// ***************************************************************************
+// Arena.cpp (c) 2018 Zhenhua Yu <qasim0208@163.com>
+// Health Informatics Lab, Ningxia University
+// All rights reserved.
+
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+#include "Arena.h"
+
+Arena::Arena(size_t chunkSize) : chunkSize(chunkSize) {
+	used = 0;
+}
+
+Arena::~Arena() {
+	release();
+}
+
+void Arena::addChunk(size_t n) {
+	char *chunk = (char*) malloc(n);
+	if(chunk == NULL) {
+		cerr << "Error: failed to allocate an arena chunk of " << n << " bytes!" << endl;
+		exit(-1);
+	}
+	chunks.push_back(chunk);
+	sizes.push_back(n);
+	used = 0;
+}
+
+void* Arena::allocate(size_t n) {
+	n = (n+15) & ~((size_t) 15);
+	if(chunks.empty() || used+n > sizes.back()) {
+		addChunk(max(chunkSize, n));
+	}
+	void *p = chunks.back()+used;
+	used += n;
+	return p;
+}
+
+void Arena::reset() {
+	//a single chunk as large as everything used so far, so the next round does not grow again
+	if(chunks.size() > 1) {
+		size_t total = capacity();
+		release();
+		addChunk(total);
+	}
+	used = 0;
+}
+
+void Arena::release() {
+	for(size_t i = 0; i < chunks.size(); i++) {
+		free(chunks[i]);
+	}
+	chunks.clear();
+	sizes.clear();
+	used = 0;
+}
+
+size_t Arena::capacity() const {
+	size_t total = 0;
+	for(size_t i = 0; i < sizes.size(); i++) {
+		total += sizes[i];
+	}
+	return total;
+}
+
@@ -0,0 +1,44 @@
+// ***************************************************************************
+// Arena.h (c) 2018 Zhenhua Yu <qasim0208@163.com>
+// Health Informatics Lab, Ningxia University
+// All rights reserved.
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// bump allocator over a list of chunks, memory is given back only by reset or release,
+// an arena is used by one thread at a time
+class Arena {
+	private:
+		size_t chunkSize;
+		vector<char*> chunks;
+		vector<size_t> sizes;
+		size_t used;
+		
+		Arena(const Arena&);
+		Arena& operator=(const Arena&);
+		
+		void addChunk(size_t n);
+		
+	public:
+		Arena(size_t chunkSize = 1 << 20);
+		~Arena();
+		
+		//n bytes aligned to 16, valid until the next reset or release
+		void* allocate(size_t n);
+		template<class T> T* allocate(size_t n) {return (T*) allocate(n*sizeof(T));}
+		
+		//forget all allocations but keep the memory, chunks are merged into one
+		void reset();
+		//free all memory
+		void release();
+		size_t capacity() const;
+};
+
+#endif
+
@@ -30,6 +30,12 @@ Config::Config() {
 	}
 	intParas.insert(make_pair("primers", 100000));
 	intParas.insert(make_pair("threads", 1));
+	intParas.insert(make_pair("seed", -1));
+	intParas.insert(make_pair("ordered", 0));
+	intParas.insert(make_pair("dropCache", 0));
+	intParas.insert(make_pair("compress", 0));
+	intParas.insert(make_pair("interleaved", 0));
+	intParas.insert(make_pair("shards", 1));
 	intParas.insert(make_pair("verbose", 1));
 	intParas.insert(make_pair("readLength", 0));
 	intParas.insert(make_pair("ploidy", 2));
@@ -0,0 +1,331 @@
+// ***************************************************************************
+// Bgzf.cpp (c) 2018 Zhenhua Yu <qasim0208@163.com>
+// Health Informatics Lab, Ningxia University
+// All rights reserved.
+
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "Bgzf.h"
+
+// a BGZF block is at most 64KB compressed and uncompressed
+static const size_t BGZF_MAX_BLOCK = 1 << 16;
+// fixed part of a gzip member header, up to and including XLEN
+static const size_t GZIP_HEADER = 12;
+
+static uint16_t getLE16(const unsigned char *p) {
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t getLE32(const unsigned char *p) {
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static bool readFully(int fd, void *buf, size_t n, uint64_t offset) {
+	size_t done = 0;
+	while(done < n) {
+		ssize_t k = pread(fd, (char*) buf+done, n-done, offset+done);
+		if(k < 0 && errno == EINTR) {
+			continue;
+		}
+		if(k <= 0) {
+			return false;
+		}
+		done += k;
+	}
+	return true;
+}
+
+//****** size of the BGZF block at coffset and the length xlen of its extra field, false if there is none ******//
+static bool parseBlockHeader(int fd, uint64_t coffset, size_t& blockSize, size_t& xlen) {
+	static thread_local vector<unsigned char> extra;
+	unsigned char header[GZIP_HEADER];
+	if(!readFully(fd, header, GZIP_HEADER, coffset)) {
+		return false;
+	}
+	if(header[0] != 31 || header[1] != 139 || header[2] != 8 || !(header[3] & 4)) {
+		return false;
+	}
+	xlen = getLE16(header+10);
+	extra.resize(xlen);
+	if(xlen == 0 || !readFully(fd, &extra[0], xlen, coffset+GZIP_HEADER)) {
+		return false;
+	}
+	//look for the BC subfield holding the block size minus 1
+	for(size_t i = 0; i+4 <= xlen; i += 4+getLE16(&extra[i+2])) {
+		if(extra[i] == 'B' && extra[i+1] == 'C' && getLE16(&extra[i+2]) == 2 && i+6 <= xlen) {
+			blockSize = getLE16(&extra[i+4])+1;
+			return true;
+		}
+	}
+	return false;
+}
+
+//****** size of the BGZF block at coffset, 0 at the end of the file ******//
+static size_t getBlockSize(int fd, uint64_t coffset, const string& fileName, size_t& xlen) {
+	unsigned char byte;
+	size_t blockSize;
+	if(!readFully(fd, &byte, 1, coffset)) {
+		return 0;
+	}
+	if(!parseBlockHeader(fd, coffset, blockSize, xlen)) {
+		cerr << "Error: " << fileName << " is not a BGZF file, broken block at offset " << coffset << "!" << endl;
+		exit(1);
+	}
+	return blockSize;
+}
+
+bool isGzipFile(const string& fileName) {
+	unsigned char magic[2];
+	ifstream ifs(fileName.c_str(), ios::binary);
+	return ifs.read((char*) magic, 2) && magic[0] == 31 && magic[1] == 139;
+}
+
+bool isBgzfFile(const string& fileName) {
+	if(!isGzipFile(fileName)) {
+		return false;
+	}
+	unsigned char header[GZIP_HEADER+6];
+	ifstream ifs(fileName.c_str(), ios::binary);
+	if(!ifs.read((char*) header, sizeof(header))) {
+		return false;
+	}
+	return (header[3] & 4) && getLE16(header+10) >= 6 && header[12] == 'B' && header[13] == 'C';
+}
+
+char* gunzipFile(const string& fileName, size_t& size) {
+	gzFile file = gzopen(fileName.c_str(), "rb");
+	if(file == NULL) {
+		cerr << "Error: cannot open file " << fileName << "!" << endl;
+		exit(1);
+	}
+	gzbuffer(file, 1 << 20);
+	size_t capacity = 1 << 24;
+	char *data = (char*) malloc(capacity);
+	size = 0;
+	while(data != NULL) {
+		if(size == capacity) {
+			capacity *= 2;
+			data = (char*) realloc(data, capacity);
+			if(data == NULL) {
+				break;
+			}
+		}
+		//gzread takes an unsigned int count
+		unsigned int n = min(capacity-size, (size_t) 1 << 30);
+		int k = gzread(file, data+size, n);
+		if(k < 0) {
+			int err;
+			cerr << "Error: failed to decompress file " << fileName << ", " << gzerror(file, &err) << "!" << endl;
+			exit(1);
+		}
+		if(k == 0) {
+			break;
+		}
+		size += k;
+	}
+	if(data == NULL) {
+		cerr << "Error: failed to allocate memory for the decompressed file " << fileName << "!" << endl;
+		exit(1);
+	}
+	gzclose(file);
+	return data;
+}
+
+bool BgzfIndex::read(const string& fileName) {
+	ifstream ifs(fileName.c_str(), ios::binary);
+	unsigned char buf[16];
+	if(!ifs.read((char*) buf, 8)) {
+		return false;
+	}
+	uint64_t n = getLE32(buf) | ((uint64_t) getLE32(buf+4) << 32);
+	coffsets.assign(1, 0);
+	uoffsets.assign(1, 0);
+	for(uint64_t i = 0; i < n; i++) {
+		if(!ifs.read((char*) buf, 16)) {
+			return false;
+		}
+		coffsets.push_back(getLE32(buf) | ((uint64_t) getLE32(buf+4) << 32));
+		uoffsets.push_back(getLE32(buf+8) | ((uint64_t) getLE32(buf+12) << 32));
+	}
+	return true;
+}
+
+bool BgzfIndex::write(const string& fileName) const {
+	ofstream ofs(fileName.c_str(), ios::binary);
+	if(!ofs.is_open()) {
+		return false;
+	}
+	vector<uint64_t> values;
+	values.push_back(coffsets.size()-1);
+	for(size_t i = 1; i < coffsets.size(); i++) {
+		values.push_back(coffsets[i]);
+		values.push_back(uoffsets[i]);
+	}
+	for(size_t i = 0; i < values.size(); i++) {
+		unsigned char buf[8];
+		for(int k = 0; k < 8; k++) {
+			buf[k] = (values[i] >> 8*k) & 0xFF;
+		}
+		ofs.write((char*) buf, 8);
+	}
+	ofs.close();
+	return !ofs.fail();
+}
+
+void BgzfIndex::build(int fd, const string& fileName) {
+	uint64_t coffset = 0, uoffset = 0;
+	size_t blockSize, xlen;
+	unsigned char isize[4];
+	coffsets.clear();
+	uoffsets.clear();
+	while((blockSize = getBlockSize(fd, coffset, fileName, xlen)) > 0) {
+		if(!readFully(fd, isize, 4, coffset+blockSize-4)) {
+			cerr << "Error: " << fileName << " is truncated at offset " << coffset << "!" << endl;
+			exit(1);
+		}
+		//empty blocks, e.g. the EOF marker, hold no data to find
+		if(getLE32(isize) > 0 || coffsets.empty()) {
+			coffsets.push_back(coffset);
+			uoffsets.push_back(uoffset);
+		}
+		uoffset += getLE32(isize);
+		coffset += blockSize;
+	}
+	if(coffsets.empty()) {
+		coffsets.push_back(0);
+		uoffsets.push_back(0);
+	}
+}
+
+//****** whether the index fits the file: its last block is a block of the file followed by empty blocks only ******//
+bool BgzfIndex::matches(int fd, uint64_t fileSize) const {
+	uint64_t coffset = coffsets.back();
+	size_t blockSize, xlen;
+	unsigned char isize[4];
+	bool last = true;
+	while(coffset < fileSize) {
+		if(!parseBlockHeader(fd, coffset, blockSize, xlen) || coffset+blockSize > fileSize
+				|| !readFully(fd, isize, 4, coffset+blockSize-4)) {
+			return false;
+		}
+		if(!last && getLE32(isize) > 0) {
+			return false;
+		}
+		last = false;
+		coffset += blockSize;
+	}
+	return coffset == fileSize;
+}
+
+size_t BgzfIndex::find(uint64_t uoffset) const {
+	return upper_bound(uoffsets.begin(), uoffsets.end(), uoffset)-uoffsets.begin()-1;
+}
+
+atomic<unsigned long> BgzfReader::nextId(1);
+
+BgzfReader::~BgzfReader() {
+	if(fd >= 0) {
+		close(fd);
+	}
+}
+
+void BgzfReader::open(const string& fileName) {
+	this->fileName = fileName;
+	fd = ::open(fileName.c_str(), O_RDONLY);
+	if(fd < 0) {
+		cerr << "Error: cannot open file " << fileName << "!" << endl;
+		exit(1);
+	}
+	id = nextId++;
+	//an index older than the file, or not ending with its blocks, belongs to a replaced file
+	string indexFile = fileName+".gzi";
+	struct stat fileStat, indexStat;
+	bool current = fstat(fd, &fileStat) == 0 && stat(indexFile.c_str(), &indexStat) == 0
+			&& indexStat.st_mtime >= fileStat.st_mtime;
+	if(!current || !index.read(indexFile) || !index.matches(fd, fileStat.st_size)) {
+		index.build(fd, fileName);
+		if(!index.write(indexFile)) {
+			cerr << "Warning: can not write index file " << indexFile << ", the blocks will be indexed again next time" << endl;
+		}
+	}
+}
+
+//****** decompress the block at coffset into out of BGZF_MAX_BLOCK bytes, returns its length ******//
+size_t BgzfReader::inflateBlock(uint64_t coffset, char *out) const {
+	static thread_local vector<unsigned char> block(BGZF_MAX_BLOCK);
+	size_t xlen, blockSize = getBlockSize(fd, coffset, fileName, xlen);
+	if(blockSize == 0 || blockSize < GZIP_HEADER+xlen+8 || !readFully(fd, &block[0], blockSize, coffset)) {
+		cerr << "Error: " << fileName << " is truncated at offset " << coffset << "!" << endl;
+		exit(1);
+	}
+	z_stream zs;
+	memset(&zs, 0, sizeof(zs));
+	zs.next_in = &block[GZIP_HEADER+xlen];
+	zs.avail_in = blockSize-GZIP_HEADER-xlen-8;
+	zs.next_out = (Bytef*) out;
+	zs.avail_out = BGZF_MAX_BLOCK;
+	if(inflateInit2(&zs, -15) != Z_OK || inflate(&zs, Z_FINISH) != Z_STREAM_END) {
+		cerr << "Error: failed to decompress the block at offset " << coffset << " of " << fileName << "!" << endl;
+		exit(1);
+	}
+	size_t n = zs.total_out;
+	inflateEnd(&zs);
+	return n;
+}
+
+size_t BgzfReader::read(uint64_t offset, char *buf, size_t n) const {
+	//the last block inflated by the thread, consecutive reads mostly fall into it
+	static thread_local vector<char> data(BGZF_MAX_BLOCK);
+	static thread_local unsigned long cachedId = 0;
+	static thread_local size_t cachedBlock = 0, cachedLen = 0;
+	size_t done = 0;
+	for(size_t i = index.find(offset); done < n && i < index.size(); i++) {
+		if(cachedId != id || cachedBlock != i) {
+			cachedLen = inflateBlock(index.getCompressedOffset(i), &data[0]);
+			cachedId = id;
+			cachedBlock = i;
+		}
+		size_t len = cachedLen;
+		uint64_t start = index.getUncompressedOffset(i);
+		if(offset+done >= start+len) {
+			continue;
+		}
+		size_t skip = offset+done-start;
+		size_t k = min(len-skip, n-done);
+		memcpy(buf+done, &data[skip], k);
+		done += k;
+	}
+	return done;
+}
+
+GzipStreamBuf::GzipStreamBuf(const string& fileName) {
+	file = gzopen(fileName.c_str(), "rb");
+	if(file == NULL) {
+		cerr << "Error: cannot open file " << fileName << "!" << endl;
+		exit(1);
+	}
+	gzbuffer(file, 1 << 20);
+	setg(buffer, buffer, buffer);
+}
+
+GzipStreamBuf::~GzipStreamBuf() {
+	gzclose(file);
+}
+
+GzipStreamBuf::int_type GzipStreamBuf::underflow() {
+	int k = gzread(file, buffer, sizeof(buffer));
+	if(k <= 0) {
+		return traits_type::eof();
+	}
+	setg(buffer, buffer, buffer+k);
+	return traits_type::to_int_type(buffer[0]);
+}
+
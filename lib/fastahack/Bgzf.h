@@ -0,0 +1,84 @@
+// ***************************************************************************
+// Bgzf.h (c) 2018 Zhenhua Yu <qasim0208@163.com>
+// Health Informatics Lab, Ningxia University
+// All rights reserved.
+
+#ifndef _BGZF_H
+#define _BGZF_H
+
+#include <string>
+#include <vector>
+#include <streambuf>
+#include <atomic>
+#include <stdint.h>
+#include <zlib.h>
+
+using namespace std;
+
+//whether the file starts with a gzip member, and whether that member is a BGZF block
+bool isGzipFile(const string& fileName);
+bool isBgzfFile(const string& fileName);
+
+//decompress a whole gzip file into memory allocated with malloc
+char* gunzipFile(const string& fileName, size_t& size);
+
+// blocks of a BGZF file as pairs of compressed and uncompressed offsets,
+// stored in .gzi files as by samtools, i.e. without the first block
+class BgzfIndex {
+	private:
+		vector<uint64_t> coffsets;
+		vector<uint64_t> uoffsets;
+		
+	public:
+		bool read(const string& fileName);
+		bool write(const string& fileName) const;
+		//walk the block headers of the file
+		void build(int fd, const string& fileName);
+		//whether the blocks of the file of fileSize bytes still end as indexed
+		bool matches(int fd, uint64_t fileSize) const;
+		
+		size_t size() const {return coffsets.size();}
+		uint64_t getCompressedOffset(size_t i) const {return coffsets[i];}
+		uint64_t getUncompressedOffset(size_t i) const {return uoffsets[i];}
+		//the last block starting at or before uoffset
+		size_t find(uint64_t uoffset) const;
+};
+
+// random access to the uncompressed data of a BGZF file, reads may run concurrently
+class BgzfReader {
+	private:
+		int fd;
+		string fileName;
+		BgzfIndex index;
+		//identifies the reader in the per-thread block cache
+		unsigned long id;
+		static atomic<unsigned long> nextId;
+		
+		size_t inflateBlock(uint64_t coffset, char *out) const;
+		
+	public:
+		BgzfReader() {fd = -1; id = 0;}
+		~BgzfReader();
+		
+		//the block index is read from fileName.gzi, or built and saved there if it is missing or stale
+		void open(const string& fileName);
+		//n bytes from uncompressed offset, returns the number of bytes read
+		size_t read(uint64_t offset, char *buf, size_t n) const;
+};
+
+// decompressing stream over a gzip file, for one pass from the start
+class GzipStreamBuf : public streambuf {
+	private:
+		gzFile file;
+		char buffer[1 << 16];
+		
+	protected:
+		int_type underflow();
+		
+	public:
+		GzipStreamBuf(const string& fileName);
+		~GzipStreamBuf();
+};
+
+#endif
+
@@ -43,10 +43,19 @@ FastaIndex::FastaIndex(void)
 {}
 
 void FastaIndex::readIndexFile(string fname) {
-    string line;
-    long long linenum = 0;
     indexFile.open(fname.c_str(), ifstream::in);
     if (indexFile.is_open()) {
+        readIndex(indexFile, fname);
+    } else {
+        cerr << "could not open index file " << fname << endl;
+        exit(1);
+    }
+}
+
+void FastaIndex::readIndex(istream& indexFile, string fname) {
+    string line;
+    long long linenum = 0;
+    {
         while (getline (indexFile, line)) {
             ++linenum;
             // the fai format defined in samtools is tab-delimited, every line being:
@@ -78,9 +87,6 @@ void FastaIndex::readIndexFile(string fname) {
                 exit(1);
             }
         }
-    } else {
-        cerr << "could not open index file " << fname << endl;
-        exit(1);
     }
 }
 
@@ -101,6 +107,17 @@ ostream& operator<<(ostream& output, FastaIndex& fastaIndex) {
 }
 
 void FastaIndex::indexReference(string refname) {
+    ifstream refFile;
+    refFile.open(refname.c_str());
+    if (refFile.is_open()) {
+        indexReference(refFile);
+    } else {
+        cerr << "could not open reference file " << refname << " for indexing!" << endl;
+        exit(1);
+    }
+}
+
+void FastaIndex::indexReference(istream& refFile) {
     // overview:
     //  for line in the reference fasta file
     //  track byte offset from the start of the file
@@ -120,9 +137,7 @@ void FastaIndex::indexReference(string refname) {
                                         // the sequence
     bool emptyLine = false;  // flag to catch empty lines, which we allow for
                              // index generation only on the last line of the sequence
-    ifstream refFile;
-    refFile.open(refname.c_str());
-    if (refFile.is_open()) {
+    {
         while (getline(refFile, line)) {
             ++line_number;
             line_length = line.length();
@@ -184,9 +199,6 @@ void FastaIndex::indexReference(string refname) {
         // we've hit the end of the fasta file!
         // flush the last entry
         flushEntryToIndex(entry);
-    } else {
-        cerr << "could not open reference file " << refname << " for indexing!" << endl;
-        exit(1);
     }
 }
 
@@ -201,17 +213,20 @@ void FastaIndex::flushEntryToIndex(FastaIndexEntry& entry) {
 
 void FastaIndex::writeIndexFile(string fname) {
     //cerr << "writing fasta index file " << fname << endl;
+    // the index is read back from its text, so names are keyed the same way as with an existing index file
+    stringstream text;
+    text << *this;
     ofstream file;
     file.open(fname.c_str());
     if (file.is_open()) {
-        file << *this;
-		sequenceNames.clear();
-        this->clear();
-        readIndexFile(fname);
+        file << text.str();
     } else {
-        cerr << "could not open index file " << fname << " for writing!" << endl;
-        exit(1);
+        // e.g. read-only storage, the index is kept in memory only
+        cerr << "Warning: could not open index file " << fname << " for writing, the reference will be indexed again next time" << endl;
     }
+    sequenceNames.clear();
+    this->clear();
+    readIndex(text, fname);
 }
 
 FastaIndex::~FastaIndex(void) {
@@ -230,12 +245,32 @@ FastaIndexEntry FastaIndex::entry(string name) {
 
 string FastaIndex::indexFileExtension() { return ".fai"; }
 
+// stream over a block of memory
+class MemoryStreamBuf : public streambuf {
+    public:
+        MemoryStreamBuf(char* data, size_t size) {
+            setg(data, data, data + size);
+        }
+};
+
 void FastaReference::open(string reffilename, bool usemmap) {
     filename = reffilename;
     if (!(file = fopen(filename.c_str(), "r"))) {
         cerr << "could not open " << filename << endl;
         exit(1);
     }
+    // bgzipped references are read block by block through their .gzi index,
+    // other gzipped references are decompressed into memory once
+    bool compressed = isGzipFile(filename);
+    if (compressed) {
+        if (isBgzfFile(filename)) {
+            bgzf = new BgzfReader();
+            bgzf->open(filename);
+        } else {
+            gzdata = gunzipFile(filename, gzsize);
+        }
+        usemmap = false;
+    }
     index = new FastaIndex();
     struct stat stFileInfo;
     string indexFileName = filename + index->indexFileExtension();
@@ -244,7 +279,17 @@ void FastaReference::open(string reffilename, bool usemmap) {
         index->readIndexFile(indexFileName);
     } else { // otherwise, read the reference and generate the index file in the cwd
         cerr << "index file " << indexFileName << " not found, generating..." << endl;
-        index->indexReference(filename);
+        if (gzdata != NULL) {
+            MemoryStreamBuf buf(gzdata, gzsize);
+            istream refFile(&buf);
+            index->indexReference(refFile);
+        } else if (bgzf != NULL) {
+            GzipStreamBuf buf(filename);
+            istream refFile(&buf);
+            index->indexReference(refFile);
+        } else {
+            index->indexReference(filename);
+        }
         index->writeIndexFile(indexFileName);
     }
     if (usemmap) {
@@ -256,6 +301,10 @@ void FastaReference::open(string reffilename, bool usemmap) {
         filesize = sb.st_size;
         // map the whole file
         filemm = mmap(NULL, filesize, PROT_READ, MAP_SHARED, fd, 0);
+        if (filemm == MAP_FAILED) {
+            cerr << "Warning: could not map " << filename << ", reading it through the file instead" << endl;
+            usingmmap = false;
+        }
     }
 }
 
@@ -266,20 +315,149 @@ FastaReference::~FastaReference(void) {
     if (usingmmap) {
         munmap(filemm, filesize);
     }
+    delete bgzf;
+    free(gzdata);
     delete index;
 }
 
+// bytes [offset, offset+n) of the uncompressed reference
+size_t FastaReference::readBytes(long long offset, char* buf, size_t n) {
+    if (gzdata != NULL) {
+        if (offset >= (long long) gzsize) {
+            return 0;
+        }
+        n = min(n, gzsize - (size_t) offset);
+        memcpy(buf, gzdata + offset, n);
+        return n;
+    } else if (bgzf != NULL) {
+        return bgzf->read(offset, buf, n);
+    } else if (usingmmap) {
+        if (offset >= (long long) filesize) {
+            return 0;
+        }
+        n = min(n, filesize - (size_t) offset);
+        memcpy(buf, (char*) filemm + offset, n);
+        return n;
+    }
+    // pread keeps concurrent reads of subsequences independent of the shared file position
+    ssize_t bytes = pread(fileno(file), buf, n, (off_t) offset);
+    return (bytes > 0)? bytes : 0;
+}
+
+// the reference when it is held in memory, mapped or decompressed, NULL otherwise
+const char* FastaReference::memoryData() {
+    if (gzdata != NULL) {
+        return gzdata;
+    } else if (usingmmap) {
+        return (const char*) filemm;
+    }
+    return NULL;
+}
+
+// exits unless the bases [start, start+length) of the entry lie in the reference
+// held in memory, e.g. with a stale index
+void FastaReference::checkInMemory(const FastaIndexEntry& entry, long start, long length) {
+    long long last = entry.offset + ((start + length - 1) / entry.line_blen) * entry.line_len
+        + (start + length - 1) % entry.line_blen + 1;
+    size_t size = (gzdata != NULL)? gzsize : filesize;
+    if (last > (long long) size) {
+        cerr << "Error: could not read " << entry.name << ":" << start << "-" << start + length
+             << " from " << filename << endl;
+        exit(1);
+    }
+}
+
+// bases [start, start+length) of the entry as runs of whole or partial lines,
+// byte o of the reference is data[o - dataOffset]
+void FastaReference::appendSpans(const FastaIndexEntry& entry, long start, long length,
+        const char* data, long long dataOffset, vector<FastaSpan>& spans) {
+    long long line = start / entry.line_blen;
+    long column = start % entry.line_blen;
+    while (length > 0) {
+        FastaSpan span;
+        span.data = data + (entry.offset + line * entry.line_len + column - dataOffset);
+        span.length = min(length, (long) entry.line_blen - column);
+        spans.push_back(span);
+        length -= span.length;
+        line++;
+        column = 0;
+    }
+}
+
+// clips [start, start+length) to the entry, returns the number of bases left
+static long clipToEntry(const FastaIndexEntry& entry, long start, long length) {
+    if (start < 0 || length < 0) {
+        cerr << "Error: cannot construct subsequence with negative offset or length" << endl;
+        exit(1);
+    }
+    if (start >= entry.length) {
+        return 0;
+    }
+    return min(length, (long) entry.length - start);
+}
+
+void FastaReference::getSubSequenceSpans(string seqname, long start, long length,
+        vector<FastaSpan>& spans, vector<char>& buffer) {
+    FastaIndexEntry entry = index->entry(seqname);
+    spans.clear();
+    length = clipToEntry(entry, start, length);
+    if (length == 0) {
+        return;
+    }
+    const char* data = memoryData();
+    if (data != NULL) {
+        checkInMemory(entry, start, length);
+        appendSpans(entry, start, length, data, 0, spans);
+    } else {
+        buffer.resize(length);
+        FastaSpan span;
+        span.data = &buffer[0];
+        span.length = copySubSequence(seqname, start, length, &buffer[0]);
+        spans.push_back(span);
+    }
+}
+
+long FastaReference::copySubSequence(string seqname, long start, long length, char* out) {
+    FastaIndexEntry entry = index->entry(seqname);
+    length = clipToEntry(entry, start, length);
+    if (length == 0) {
+        return 0;
+    }
+    static thread_local vector<FastaSpan> spans;
+    static thread_local vector<char> raw;
+    spans.clear();
+    const char* data = memoryData();
+    if (data != NULL) {
+        checkInMemory(entry, start, length);
+        appendSpans(entry, start, length, data, 0, spans);
+    } else {
+        // the lines covering the bases are read at once, then compacted into out
+        long long first = entry.offset + (start / entry.line_blen) * entry.line_len + start % entry.line_blen;
+        long long last = entry.offset + ((start + length - 1) / entry.line_blen) * entry.line_len
+            + (start + length - 1) % entry.line_blen + 1;
+        raw.resize(last - first);
+        size_t bytes = readBytes(first, &raw[0], last - first);
+        if (bytes < (size_t) (last - first)) {
+            cerr << "Error: could not read " << seqname << ":" << start << "-" << start + length
+                 << " from " << filename << endl;
+            exit(1);
+        }
+        appendSpans(entry, start, length, &raw[0], first, spans);
+    }
+    char* p = out;
+    for (size_t i = 0; i < spans.size(); i++) {
+        memcpy(p, spans[i].data, spans[i].length);
+        p += spans[i].length;
+    }
+    return length;
+}
+
 string FastaReference::getSequence(string seqname) {
     FastaIndexEntry entry = index->entry(seqname);
     int newlines_in_sequence = entry.length / entry.line_blen;
     int seqlen = newlines_in_sequence  + entry.length;
     char* seq = (char*) calloc (seqlen + 1, sizeof(char));
-    if (usingmmap) {
-        memcpy(seq, (char*) filemm + entry.offset, seqlen);
-    } else {
-        fseek64(file, entry.offset, SEEK_SET);
-        size_t bytes = fread(seq, sizeof(char), seqlen, file);
-    }
+    readBytes(entry.offset, seq, seqlen);
     seq[seqlen] = '\0';
     char* pbegin = seq;
     char* pend = seq + (seqlen/sizeof(char));
@@ -316,12 +494,7 @@ string FastaReference::getSubSequence(string seqname, int start, int length) {
     int newlines_inside = newlines_by_end - newlines_before;
     int seqlen = length + newlines_inside;
     char* seq = (char*) calloc (seqlen + 1, sizeof(char));
-    if (usingmmap) {
-        memcpy(seq, (char*) filemm + entry.offset + newlines_before + start, seqlen);
-    } else {
-        fseek64(file, (off_t) (entry.offset + newlines_before + start), SEEK_SET);
-        size_t bytes = fread(seq, sizeof(char), (off_t) seqlen, file);
-    }
+    readBytes(entry.offset + newlines_before + start, seq, seqlen);
     seq[seqlen] = '\0';
     char* pbegin = seq;
     char* pend = seq + (seqlen/sizeof(char));
@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <sstream>
+#include "Bgzf.h"
 
 using namespace std;
 
@@ -47,7 +49,9 @@ class FastaIndex : public map<string, FastaIndexEntry> {
         ~FastaIndex(void);
         vector<string> sequenceNames;
         void indexReference(string refName);
+        void indexReference(istream& refFile);
         void readIndexFile(string fname);
+        void readIndex(istream& indexFile, string fname);
         void writeIndexFile(string fname);
         ifstream indexFile;
         FastaIndexEntry entry(string key);
@@ -55,6 +59,12 @@ class FastaIndex : public map<string, FastaIndexEntry> {
         string indexFileExtension(void);
 };
 
+// bases of a sequence lying contiguously in the reference, i.e. a line or a part of it
+struct FastaSpan {
+    const char* data;
+    size_t length;
+};
+
 class FastaReference {
     public:
         void open(string reffilename, bool usemmap = false);
@@ -63,17 +73,34 @@ class FastaReference {
         FastaReference(void) : usingmmap(false) {
 		file = NULL;
 		index = NULL;
+		bgzf = NULL;
+		gzdata = NULL;
+		gzsize = 0;
 	}
         ~FastaReference(void);
         FILE* file;
         void* filemm;
         size_t filesize;
         FastaIndex* index;
+        // compressed references, offsets of the index are in the uncompressed data
+        BgzfReader* bgzf;
+        char* gzdata;
+        size_t gzsize;
+        size_t readBytes(long long offset, char* buf, size_t n);
+        const char* memoryData();
+        void checkInMemory(const FastaIndexEntry& entry, long start, long length);
+        void appendSpans(const FastaIndexEntry& entry, long start, long length,
+                const char* data, long long dataOffset, vector<FastaSpan>& spans);
         vector<FastaIndexEntry> findSequencesStartingWith(string seqnameStart);
         string getSequence(string seqname);
         // potentially useful for performance, investigate
         // void getSequence(string seqname, string& sequence);
         string getSubSequence(string seqname, int start, int length);
+        // bases [start, start+length) of seqname, clipped to its end, as views into the reference when it is
+        // mapped or decompressed in memory; otherwise they are read once into buffer, which backs the single span
+        void getSubSequenceSpans(string seqname, long start, long length, vector<FastaSpan>& spans, vector<char>& buffer);
+        // copies the same bases once into out, without line ends or terminator, returns their number
+        long copySubSequence(string seqname, long start, long length, char* out);
         string sequenceNameStartingWith(string seqnameStart);
         long unsigned int sequenceLength(string seqname);
 	string getFileName();
@@ -11,47 +11,48 @@
 
 #include "MyDefine.h"
 #include "Fragment.h"
+#include "Arena.h"
 
 int Fragment::maxSize = 100000;
 int Fragment::minSize = 10000;
 
-Fragment::Fragment(string chr, long startPos, int length, int strand) {
-	assert(!chr.empty());
+Fragment::Fragment(int chr, unsigned long offset, long startPos, int length, int strand) {
+	assert(chr >= 0);
 	assert(startPos >= 0);
 	//assert(length >= minSize && length <= maxSize);
 	assert(strand == 1 || strand == -1);
 	this->chr = chr;
+	this->offset = offset;
 	this->startPos = startPos;
 	this->length = length;
 	this->strand = strand;
-	
-	this->sequence = NULL;
+	this->gcContent = 0;
+	this->primerNum = 0;
 }
 
-Fragment::~Fragment() {
-	delete[] sequence;
+string Fragment::getChr() {
+	return genome.getChroms()[chr];
 }
 
 void Fragment::describe() {
-	cerr << "chr=" << chr << ", spos=" << startPos 
+	cerr << "chr=" << getChr() << ", spos=" << startPos 
 		<< ", length=" << length << ", strand=" << strand << endl;
 }
 
-void Fragment::createSequence() {
-	sequence = genome.getSubSequence(chr, startPos-1, length);
-	if(strand == 1) {
-		reverse(sequence, sequence+strlen(sequence));
+void Fragment::decode(unsigned int from, unsigned int n, char* out, bool complement) {
+	PackedSeq& packed = genome.getPackedGenome();
+	if(strand == -1) {
+		packed.decode(offset+from, n, out, !complement);
 	}
 	else {
-		sequence = getComplementSeq(sequence);
+		packed.decode(offset+length-from-n, n, out, complement);
+		reverse(out, out+n);
 	}
-	gcContent = countGC(sequence);
-	
 }
 
-void Fragment::amplify(AmpliconLink& results) {
-	unsigned int i, j, k, n;
-	unsigned int spos, ampliconLen, curSize;
+void Fragment::amplify(AmpliconStore& results) {
+	unsigned int i, j;
+	unsigned int spos, ampliconLen;
 	double ber = config.getRealPara("ber");
 	
 	string bases = config.getStringPara("bases");
@@ -62,30 +63,28 @@ void Fragment::amplify(AmpliconLink& results) {
 		return;
 	}
 	
-	char* fragSeq = getSequence();
-	char* fragSeq_c = new char[strlen(fragSeq)+1];
-	strcpy(fragSeq_c, fragSeq);
-	fragSeq_c = getComplementSeq(fragSeq_c);
+	Arena& scratch = getScratchArena();
+	char* fragSeq_c = scratch.allocate<char>(length+1);
+	decode(0, length, fragSeq_c, true);
+	fragSeq_c[length] = '\0';
 	
-	short int* posAttached = new short int[length];
-	memset(posAttached, 0, length*sizeof(short int));
+	//one bit for every position a primer is attached to
+	unsigned long* posAttached = scratch.allocate<unsigned long>(length/64+1);
+	memset(posAttached, 0, (length/64+1)*sizeof(unsigned long));
 	
 	for(i = 0; i < primerNum; i++) {
 		int tryTimes = 0;
 		do {
-			spos = threadPool->randomInteger(27, length);
-			ampliconLen = threadPool->randomDouble(minLen, maxLen+1);
+			spos = randomInteger(27, length);
+			ampliconLen = randomDouble(minLen, maxLen+1);
 			tryTimes++;
 			if(tryTimes > 50) {
 				break;
 			}
-			if(spos+ampliconLen > length || posAttached[spos] == 1) {
+			if(spos+ampliconLen > (unsigned int) length || ((posAttached[spos/64] >> (spos%64)) & 1)) {
 				continue;
 			}
-			char c = fragSeq_c[spos+8];
-			fragSeq_c[spos+8] = '\0';
 			j = malbac.updatePrimerCount(&fragSeq_c[spos], -1);
-			fragSeq_c[spos+8] = c;
 			if(j == 1) {
 				break;
 			}
@@ -94,60 +93,29 @@ void Fragment::amplify(AmpliconLink& results) {
 			break;
 		}
 		
-		posAttached[spos] = 1;
+		posAttached[spos/64] |= 1UL << (spos%64);
 		
 		char c = fragSeq_c[spos+ampliconLen];
 		fragSeq_c[spos+ampliconLen] = '\0';
 		int gcNum = countGC(fragSeq_c+spos);
 		fragSeq_c[spos+ampliconLen] = c;	
 		
-		vector<AmpError> errs;
-		for(j = 8; j < ampliconLen; j++) {
-			double p = threadPool->randomDouble(0, 1);
-			if(p < ber) {
-				char base = fragSeq_c[spos+j];
-				do {
-					n = threadPool->randomInteger(0, bases.size());
-				} while(bases[n] == base);
-				
-				if(bases[n] == 'C' || bases[n] == 'G') {
-					gcNum++;
-				}
-				if(base == 'C' || base == 'G') {
-					gcNum--;
-				}
-				
-				AmpError ampErr(1, j, n);
-				errs.push_back(ampErr);
-			}
-		}
-		AmpError *ampErrs = NULL;
-		if(!errs.empty()) {
-			ampErrs = new AmpError[errs.size()+1];
-			for(j = 0; j < errs.size(); j++) {
-				memcpy(ampErrs[j].getData(), errs[j].getData(), 4);
-			}
-			ampErrs[j].setAlt(bases.size());
-		}
+		AmpError *ampErrs = createAmpErrors(fragSeq_c+spos, ampliconLen, ber, gcNum);
 		Amplicon tmp(true, this, ampErrs, spos, ampliconLen, max(0, gcNum));
-		insertLinkList(results, tmp);
+		results.push_back(tmp);
 	}
-	delete[] fragSeq_c;
-	delete[] posAttached;
 }
 
 void* Fragment::batchAmplify(const void* args) {
-	unsigned long* indexs = (unsigned long*) args;
-	unsigned long sindx = indexs[0];
-	unsigned long eindx = indexs[1];
+	AmplifyTask* task = (AmplifyTask*) args;
 	unsigned long i;
 	vector<Fragment>& frags = malbac.getFrags();
-	AmpliconLink results = createNullLink();
 	
-	for(i = sindx; i <= eindx; i++) {
-		frags[i].amplify(results);
+	for(i = task->begin; i < task->end; i++) {
+		localRandomEngine.setStream(STAGE_FRAG_AMPLIFY, i, task->cycle);
+		getScratchArena().reset();
+		frags[i].amplify(task->products);
 	}
-	
-	malbac.extendSemiAmplicons(results);
+	return NULL;
 }
 
@@ -15,9 +15,12 @@
 
 using namespace std;
 
+// a strand of a locus, viewed in the packed genome: strand 1 reads the locus backwards,
+// strand -1 reads its complement forwards
 class Fragment {
 	private:
-		string chr;
+		int chr;
+		unsigned long offset;
 		long startPos;
 		int length;
 		int strand;
@@ -25,34 +28,33 @@ class Fragment {
 		int gcContent;
 		int primerNum;
 		
-		char* sequence;
-		
 	public:	
 		static int minSize, maxSize;
-		Fragment(string chr, long startPos, int length, int strand);
-		~Fragment();
+		Fragment(int chr, unsigned long offset, long startPos, int length, int strand);
 
 		static void setMaxSize(unsigned int size) {maxSize = size;}
 		static int getMaxSize() {return maxSize;}
 		static void setMinSize(unsigned int size) {minSize = size;}
 		static int getMinSize() {return minSize;}
 		
-		string getChr() {return chr;}
+		string getChr();
+		unsigned long getOffset() {return offset;}
 		long getStartPos() {return startPos;}
 		int getLength() {return length;}
 		void setLength(int length) {this->length = length;}
 		int getStrand() {return strand;}
 		int getGCcontent() {return gcContent;}
+		void setGCcontent(int gcContent) {this->gcContent = gcContent;}
 		
 		void describe();
 		
 		void setPrimers(int primers) {primerNum = primers;}
 		int getPrimers() {return primerNum;}
 		
-		void createSequence();
-		char* getSequence() {return sequence;}
+		//write bases [from, from+n) of the sequence, or their complements, to out
+		void decode(unsigned int from, unsigned int n, char* out, bool complement);
 		
-		void amplify(AmpliconLink& results);
+		void amplify(AmpliconStore& results);
 		static void* batchAmplify(const void* args);
 };
 
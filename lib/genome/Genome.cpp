@@ -8,7 +8,11 @@
 #include <sstream>
 #include <cassert>
 #include <cmath>
+#include <cstring>
+#include <cerrno>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <algorithm>
 
 #include "split.h"
@@ -125,6 +129,8 @@ void Genome::loadAbers() {
 				exit(1);
 			}
 			varType type = (typeCode.compare("het") == 0)? het : homo;
+			//inserted bases are written as they are, in upper case like the reference
+			transform(seq.begin(), seq.end(), seq.begin(), (int (*)(int))toupper);
 			Insert insert(pos, seq, type);
 			inserts[chr].push_back(insert);
 			insertCount++;
@@ -180,12 +186,8 @@ void Genome::loadRefSeq() {
 		cerr << "reference sequence file not specified!" << endl;
 		exit(1);
 	}
-	if(strcmp(tmp.substr(tmp.length()-3).c_str(), ".gz") == 0) {
-		string cmd = "gzip -cd " + tmp + " > "+tmp.substr(0, tmp.length()-3);
-		system(cmd.c_str());
-		tmp = tmp.substr(0, refFile.length()-3);
-	}
-	fr.open(tmp, false);
+	//plain references are mapped, gzipped ones are read in place, see FastaReference::open
+	fr.open(tmp, true);
 	chromosomes = (*(fr.index)).sequenceNames;
 	if(chromosomes.empty()) {
 		cerr << "ERROR: reference sequence cannot be empty!" << endl;
@@ -269,12 +271,16 @@ long Genome::getGenomeLength() {
 	return n;
 }
 
-char* Genome::getSubSequence(string chr, int startPos, int length) {
-	string seq = fr.getSubSequence(chr, startPos, length);
-	transform(seq.begin(), seq.end(), seq.begin(), (int (*)(int))toupper);
-	char* s = new char[seq.length()+1];
-	strcpy(s, seq.c_str());
-	return s;
+char* Genome::getSubSequence(string chr, long startPos, long length, vector<char>& buffer) {
+	buffer.resize(length+1);
+	long n = fr.copySubSequence(chr, startPos, length, &buffer[0]);
+	transform(buffer.begin(), buffer.begin()+n, buffer.begin(), (int (*)(int))toupper);
+	buffer[n] = '\0';
+	return &buffer[0];
+}
+
+void Genome::getSubSequenceSpans(string chr, long startPos, long length, vector<FastaSpan>& spans, vector<char>& buffer) {
+	fr.getSubSequenceSpans(chr, startPos, length, spans, buffer);
 }
 
 char* Genome::getSubRefSequence(string chr, int startPos, int length) {
@@ -312,7 +318,10 @@ void Genome::generateChrSequence(string chr) {
 	vector<Insert>& insertsOfChr = getRealInserts(chr);
 	vector<Deletion>& delsOfChr = getRealDels(chr);
 	
-	refSequence = fr.getSubSequence(chr, 0, getChromLen(chr));
+	refSequence.resize(getChromLen(chr));
+	if(!refSequence.empty()) {
+		refSequence.resize(fr.copySubSequence(chr, 0, refSequence.length(), &refSequence[0]));
+	}
 	altSequence = refSequence;
 	for(j = 0; j < snvsOfChr.size(); j++) {
 		SNV snv = snvsOfChr[j];
@@ -326,85 +335,398 @@ void Genome::generateChrSequence(string chr) {
 	transform(altSequence.begin(), altSequence.end(), altSequence.begin(), (int (*)(int))toupper);
 }
 
-void Genome::saveSequence() {
+// fasta records written from a fixed offset of the output, the bases are wrapped into lines
+// and written in large blocks, sequentially if the output cannot seek
+class FastaWriter {
+	private:
+		int fd;
+		bool seekable;
+		off_t offset;
+		unsigned int width;
+		unsigned int column;
+		char *buffer;
+		size_t used;
+		size_t capacity;
+		
+		void reserve(size_t n) {
+			if(used+n > capacity) {
+				flush();
+			}
+		}
+		
+	public:
+		FastaWriter(int fd, bool seekable, off_t offset, unsigned int width) : fd(fd), seekable(seekable), offset(offset), width(width) {
+			column = 0;
+			used = 0;
+			capacity = 1 << 20;
+			buffer = new char[capacity];
+		}
+		~FastaWriter() {
+			flush();
+			delete[] buffer;
+		}
+		
+		static unsigned long recordSize(const string& name, unsigned long length, unsigned int width) {
+			return name.length()+2+length+(length+width-1)/width;
+		}
+		
+		void beginRecord(const string& name) {
+			reserve(name.length()+2);
+			buffer[used++] = '>';
+			memcpy(buffer+used, name.c_str(), name.length());
+			used += name.length();
+			buffer[used++] = '\n';
+			column = 0;
+		}
+		
+		void append(const char *seq, size_t n) {
+			while(n > 0) {
+				size_t k = min(n, (size_t) (width-column));
+				reserve(k+1);
+				memcpy(buffer+used, seq, k);
+				used += k;
+				seq += k;
+				n -= k;
+				column += k;
+				if(column == width) {
+					buffer[used++] = '\n';
+					column = 0;
+				}
+			}
+		}
+		
+		void endRecord() {
+			if(column > 0) {
+				reserve(1);
+				buffer[used++] = '\n';
+				column = 0;
+			}
+		}
+		
+		void flush() {
+			size_t done = 0;
+			while(done < used) {
+				ssize_t k = seekable? pwrite(fd, buffer+done, used-done, offset+done) : write(fd, buffer+done, used-done);
+				if(k < 0 && errno == EINTR) {
+					continue;
+				}
+				if(k <= 0) {
+					cerr << "Error: failed to write the simulated sequences, " << strerror(errno) << "!" << endl;
+					exit(-1);
+				}
+				done += k;
+			}
+			offset += used;
+			used = 0;
+		}
+};
+
+static const unsigned int FASTA_WIDTH = 100;
+
+static bool subsBefore(const pair<unsigned long, char>& a, const pair<unsigned long, char>& b) {
+	return a.first < b.first;
+}
+
+// bases of a haplotype copy staged in a window of bounded size on their way to the writer,
+// reference bases are read window by window, so a segment is never held as a whole
+class HapWindow {
+	private:
+		FastaWriter *writer;
+		vector<char>& data;
+		size_t used;
+		
+		static vector<char>& getBuffer() {
+			static thread_local vector<char> buffer(1 << 20);
+			return buffer;
+		}
+		
+	public:
+		HapWindow(FastaWriter *writer) : writer(writer), data(getBuffer()) {used = 0;}
+		
+		void flush() {
+			if(used > 0) {
+				writer->append(&data[0], used);
+				used = 0;
+			}
+		}
+		
+		void put(const char *seq, size_t n) {
+			while(n > 0) {
+				size_t k = min(n, data.size()-used);
+				memcpy(&data[used], seq, k);
+				used += k;
+				seq += k;
+				n -= k;
+				if(used == data.size()) {
+					flush();
+				}
+			}
+		}
+		
+		//n reference bases from offset from of the segment starting at segStartPos (1-based), upper-cased with
+		//the substitutions subs applied, s is the first substitution not yet passed
+		void putReference(const string& chr, long segStartPos, unsigned long from, unsigned long n,
+				const vector<pair<unsigned long, char> >& subs, size_t& s) {
+			static thread_local vector<FastaSpan> spans;
+			static thread_local vector<char> buffer;
+			while(n > 0) {
+				unsigned long k = min(n, (unsigned long) (data.size()-used));
+				genome.getSubSequenceSpans(chr, segStartPos-1+from, k, spans, buffer);
+				char *dst = &data[used];
+				for(size_t j = 0; j < spans.size(); j++) {
+					for(size_t t = 0; t < spans[j].length; t++) {
+						*dst++ = toupper(spans[j].data[t]);
+					}
+				}
+				if((unsigned long) (dst-&data[used]) != k) {
+					cerr << "Error: failed to read bases " << segStartPos+from << "-" << segStartPos+from+k-1 << " of chromosome " << chr << " from the reference!" << endl;
+					exit(1);
+				}
+				for(; s < subs.size() && subs[s].first < from+k; s++) {
+					if(subs[s].first >= from) {
+						data[used+subs[s].first-from] = subs[s].second;
+					}
+				}
+				used += k;
+				from += k;
+				n -= k;
+				if(used == data.size()) {
+					flush();
+				}
+			}
+		}
+};
+
+static string getHaplotypeName(const string& chr, int hap, long chrLen) {
+	stringstream ss;
+	ss << chr << "_" << hap+1 << "_" << chrLen;
+	return ss.str();
+}
+
+//****** split a chromosome into segments by its CNVs and choose the copies of every haplotype ******//
+void* Genome::batchPlanChrom(const void* args) {
+	HapTask* task = (HapTask*) args;
 	int ploidy = config.getIntPara("ploidy");
 	int mCN = (int) ceil((float) ploidy/2);
-	int i, j, k;
+	string chr = genome.chromosomes[task->chrIndex];
+	long chrLen = genome.getChromLen(chr);
+	vector<CNV>& cnvsOfChr = genome.getSimuCNVs(chr);
+	long segStartPos = 1;
+	size_t i;
+	int j;
+	
+	localRandomEngine.setStream(STAGE_HAPLOTYPES, task->chrIndex, 0);
+	for(i = 0; i < cnvsOfChr.size(); i++) {
+		if(segStartPos > chrLen) {
+			break;
+		}
+		CNV cnv = cnvsOfChr[i];
+		cnv.epos = min(cnv.epos, chrLen);
+		if(segStartPos < cnv.spos) {
+			genome.planSegment(task->segments, segStartPos, cnv.spos-1, ploidy, mCN);
+		}
+		genome.planSegment(task->segments, cnv.spos, cnv.epos, cnv.CN, cnv.mCN);
+		segStartPos = cnv.epos+1;
+	}
+	if(segStartPos <= chrLen) {
+		genome.planSegment(task->segments, segStartPos, chrLen, ploidy, mCN);
+	}
+	
+	//only insertions and deletions change the lengths of the haplotypes
+	ChromVariants order;
+	order.inserts.build(genome.getSimuInserts(chr));
+	order.dels.build(genome.getSimuDels(chr));
+	task->lengths.assign(ploidy, 0);
+	for(j = 0; j < ploidy; j++) {
+		for(i = 0; i < task->segments.size(); i++) {
+			task->lengths[j] += genome.generateSegment(task->segments[i], chr, order, j, NULL);
+		}
+	}
+	return NULL;
+}
+
+//****** write the haplotypes of a chromosome to their part of the output ******//
+void* Genome::batchWriteChrom(const void* args) {
+	HapTask* task = (HapTask*) args;
+	int ploidy = config.getIntPara("ploidy");
+	string chr = genome.chromosomes[task->chrIndex];
+	long chrLen = genome.getChromLen(chr);
+	
+	ChromVariants order;
+	order.snps.build(genome.getSimuSNPs(chr));
+	order.snvs.build(genome.getSimuSNVs(chr));
+	order.inserts.build(genome.getSimuInserts(chr));
+	order.dels.build(genome.getSimuDels(chr));
+	
+	FastaWriter writer(task->fd, task->seekable, task->offset, FASTA_WIDTH);
+	for(int j = 0; j < ploidy; j++) {
+		writer.beginRecord(getHaplotypeName(chr, j, chrLen));
+		for(size_t i = 0; i < task->segments.size(); i++) {
+			genome.generateSegment(task->segments[i], chr, order, j, &writer);
+		}
+		writer.endRecord();
+	}
+	return NULL;
+}
+
+void Genome::saveSequence() {
+	int ploidy = config.getIntPara("ploidy");
+	size_t i;
+	int j;
 	
 	string outFile = config.getStringPara("output");
-	ofstream ofs;
-	ofs.open(outFile.c_str());
-	if(!ofs.is_open()) {
+	int fd = open(outFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
 		cerr << "can not open file " << outFile << endl;
 		exit(-1);
 	}
+	//a pipe or a terminal is written chromosome by chromosome
+	struct stat st;
+	bool seekable = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+	//an index left by an earlier run must not outlive the sequences it describes
+	string indexFile = outFile+".fai";
+	if(seekable) {
+		unlink(indexFile.c_str());
+	}
 	
+	//variants of every chromosome are only read by the tasks
 	for(i = 0; i < chromosomes.size(); i++) {
 		string chr = chromosomes[i];
-		vector<CNV>& cnvsOfChr = getSimuCNVs(chr);
-		long segStartPos = 1, segEndPos = -1;
-		
-		vector<string> chrSequences(ploidy, "");
-		for(j = 0; j < cnvsOfChr.size(); j++) {		
-			if(segStartPos > getChromLen(chr)) {
-				break;
-			}
-			CNV cnv = cnvsOfChr[j];
-			cnv.epos = min(cnv.epos, getChromLen(chr));
-			if(segStartPos < cnv.spos) {
-				generateSegment(chrSequences, chr, segStartPos, cnv.spos-1, ploidy, mCN);
-			}
-			generateSegment(chrSequences, chr, cnv.spos, cnv.epos, cnv.CN, cnv.mCN);
-			segStartPos = cnv.epos+1;
+		getSimuCNVs(chr);
+		getSimuSNPs(chr);
+		getSimuSNVs(chr);
+		getSimuInserts(chr);
+		getSimuDels(chr);
+	}
+	
+	HapTask* tasks = new HapTask[chromosomes.size()];
+	for(i = 0; i < chromosomes.size(); i++) {
+		tasks[i].chrIndex = i;
+		tasks[i].fd = fd;
+		tasks[i].seekable = seekable;
+		threadPool->pool_add_work(&Genome::batchPlanChrom, &tasks[i], i);
+	}
+	threadPool->wait();
+	
+	//the chromosomes are laid out in reference order, which also gives the entries of the index
+	unsigned long offset = 0;
+	vector<FastaIndexEntry> entries;
+	for(i = 0; i < chromosomes.size(); i++) {
+		long chrLen = getChromLen(chromosomes[i]);
+		tasks[i].offset = offset;
+		for(j = 0; j < ploidy; j++) {
+			string name = getHaplotypeName(chromosomes[i], j, chrLen);
+			entries.push_back(FastaIndexEntry(name, tasks[i].lengths[j], offset+name.length()+2, FASTA_WIDTH, FASTA_WIDTH+1));
+			offset += FastaWriter::recordSize(name, tasks[i].lengths[j], FASTA_WIDTH);
 		}
-		if(segStartPos <= getChromLen(chr)) {
-			segEndPos = getChromLen(chr);
-			generateSegment(chrSequences, chr, segStartPos, getChromLen(chr), ploidy, mCN);
+	}
+	
+	if(seekable) {
+		if(ftruncate(fd, offset) != 0) {
+			cerr << "Error: failed to resize file " << outFile << ", " << strerror(errno) << "!" << endl;
+			exit(-1);
 		}
-		
-		for(j = 0; j < ploidy; j++) {
-			stringstream ss;
-			ss << j+1;
-			ofs << ">" << chr << "_" << ss.str() << "_" << getChromLen(chr) << endl;
-			unsigned int sindx = 0;
-			unsigned int length = chrSequences[j].length();
-			int width = 100;
-			while(sindx < length) {
-				if(sindx+width > length) {
-					ofs << chrSequences[j].substr(sindx) << endl;
-				}
-				else {
-					ofs << chrSequences[j].substr(sindx, width) << endl;
-				}
-				sindx += width;
-			}
+		for(i = 0; i < chromosomes.size(); i++) {
+			threadPool->pool_add_work(&Genome::batchWriteChrom, &tasks[i], i);
+		}
+		threadPool->wait();
+	}
+	else {
+		for(i = 0; i < chromosomes.size(); i++) {
+			batchWriteChrom(&tasks[i]);
+		}
+	}
+	delete[] tasks;
+	
+	if(close(fd) != 0) {
+		cerr << "Error: failed to close file " << outFile << ", " << strerror(errno) << "!" << endl;
+		exit(-1);
+	}
+	
+	//genreads then opens the sequences without indexing them again
+	if(seekable) {
+		ofstream ofs;
+		ofs.open(indexFile.c_str());
+		if(!ofs.is_open()) {
+			cerr << "Warning: can not write index file " << indexFile << "!" << endl;
+			return;
+		}
+		for(i = 0; i < entries.size(); i++) {
+			ofs << entries[i] << endl;
 		}
+		ofs.close();
 	}
-	ofs.close();
 }
 
-void Genome::generateSegment(vector<string>& sequences, string chr, long segStartPos, long segEndPos, int CN, int mCN) {
-	if(CN == 0) {
-		return;
+void VariantOrder::build(vector<pair<long, int> >& items) {
+	sorted = true;
+	for(size_t i = 1; i < items.size(); i++) {
+		if(items[i].first < items[i-1].first) {
+			sorted = false;
+			break;
+		}
+	}
+	if(!sorted) {
+		sort(items.begin(), items.end());
 	}
+	positions.resize(items.size());
+	indexs.resize(items.size());
+	for(size_t i = 0; i < items.size(); i++) {
+		positions[i] = items[i].first;
+		indexs[i] = items[i].second;
+	}
+}
 
-	char* refSeq = getSubSequence(chr, segStartPos-1, segEndPos-segStartPos+1);
-	if(refSeq == NULL) {
-		return;
+void VariantOrder::find(long spos, long epos, vector<int>& byInput, vector<int> *byPos) const {
+	vector<long>::const_iterator lo = lower_bound(positions.begin(), positions.end(), spos);
+	vector<long>::const_iterator hi = upper_bound(positions.begin(), positions.end(), epos);
+	byInput.assign(indexs.begin()+(lo-positions.begin()), indexs.begin()+(hi-positions.begin()));
+	if(byPos != NULL) {
+		*byPos = byInput;
 	}
+	if(!sorted) {
+		sort(byInput.begin(), byInput.end());
+	}
+}
 
-	transform(refSeq, refSeq+strlen(refSeq), refSeq, (int (*)(int))toupper);
-	
-	vector<SNP>& snpsOfChr = getSimuSNPs(chr);
-	vector<SNV>& snvsOfChr = getSimuSNVs(chr);
-	vector<Insert>& insertsOfChr = getSimuInserts(chr);
-	vector<Deletion>& delsOfChr = getSimuDels(chr);
-	
+// haplotypes a variant of a segment goes to
+enum {VAR_ALL = 0, VAR_MAJOR = 1, VAR_MINOR = 2};
+
+//****** group of the next variant, het variants alternate between the major and the minor haplotypes ******//
+static unsigned char getVarGroup(varType type, int& k) {
+	if(type == homo) {
+		return VAR_ALL;
+	}
+	unsigned char group = VAR_MAJOR+k;
+	k = (k+1)%2;
+	return group;
+}
+
+static bool hasVariant(unsigned char group, bool major) {
+	return group == VAR_ALL || (group == VAR_MAJOR) == major;
+}
+
+// group of variant id, ids are in input order
+static unsigned char getGroup(vector<int>& ids, vector<unsigned char>& groups, int id) {
+	return groups[lower_bound(ids.begin(), ids.end(), id)-ids.begin()];
+}
+
+//****** choose the copies of every haplotype in the segment [segStartPos, segEndPos] with CN copies ******//
+void Genome::planSegment(vector<HapSegment>& segments, long segStartPos, long segEndPos, int CN, int mCN) {
 	int i, j, k, n;
 	int ploidy = config.getIntPara("ploidy");
-	unsigned int refSize = strlen(refSeq);
 	vector<int>::iterator it;
 	
+	HapSegment seg;
+	seg.spos = segStartPos;
+	seg.epos = segEndPos;
+	seg.copies.assign(ploidy, 0);
+	seg.major.assign(ploidy, false);
+	if(CN == 0) {
+		segments.push_back(seg);
+		return;
+	}
+	
 	vector<int> mIndx;
 	vector<int> seqReps;
 	
@@ -467,227 +789,127 @@ void Genome::generateSegment(vector<string>& sequences, string chr, long segStar
 		}
 	}
 	
-	vector<string> segSeqs;
-	if(CN < ploidy) {
-		for(i = 0; i < ploidy; i++) {
-			it = find(seqReps.begin(), seqReps.end(), i);
-			if(it != seqReps.end()) {
-				segSeqs.push_back(refSeq);
-			}
-			else {
-				segSeqs.push_back("");
-			}
+	//copies of every haplotype in the segment
+	for(i = 0; i < ploidy; i++) {
+		if(CN < ploidy) {
+			seg.copies[i] = (find(seqReps.begin(), seqReps.end(), i) != seqReps.end());
 		}
-	}
-	else {
-		for(i = 0; i < ploidy; i++) {
-			string tmp = "";
-			for(j = 0; j < seqReps[i]; j++) {
-				tmp += refSeq;
-			}
-			segSeqs.push_back(tmp);
+		else {
+			seg.copies[i] = seqReps[i];
 		}
 	}
-	delete[] refSeq;
+	for(size_t m = 0; m < mIndx.size(); m++) {
+		seg.major[mIndx[m]] = true;
+	}
 	
-	//simu SNP
-	k = 0;
-	for(i = 0; i < snpsOfChr.size(); i++) {
-		SNP snp = snpsOfChr[i];
-		long pos = snp.getPosition();
-		if(pos >= segStartPos && pos <= segEndPos) {
-			int sindx = pos-segStartPos;
-			for(j = 0; j < ploidy; j++) {
-				it = find(mIndx.begin(), mIndx.end(), j);
-				if((k == 0 && it == mIndx.end()) || (k == 1 && it != mIndx.end())) {
-					continue;
-				}
-				string& segSeq = segSeqs[j];
-				unsigned int segLen = segSeq.length();
-				for(int t = 0; t < segLen/refSize; t++) {
-					segSeq[sindx+t*refSize] = snp.getNucleotide();
-				}
-			}
-			k = (k+1)%2;
-		}
+	segments.push_back(seg);
+}
+
+//****** bases of haplotype hap in the segment, written to writer unless it is NULL ******//
+unsigned long Genome::generateSegment(HapSegment& seg, string chr, ChromVariants& order, int hap, FastaWriter *writer) {
+	int copies = seg.copies[hap];
+	bool major = seg.major[hap];
+	if(copies == 0) {
+		return 0;
 	}
+	long segStartPos = seg.spos, segEndPos = seg.epos;
+	unsigned long refSize = segEndPos-segStartPos+1;
+	
+	vector<SNP>& snpsOfChr = getSimuSNPs(chr);
+	vector<SNV>& snvsOfChr = getSimuSNVs(chr);
+	vector<Insert>& insertsOfChr = getSimuInserts(chr);
+	vector<Deletion>& delsOfChr = getSimuDels(chr);
+	
+	size_t i;
+	int k;
 	
-	//simu SNV
+	//variants of the segment, het ones alternate between the haplotypes of mIndx and the others in input order
+	vector<int> snpIds, snvIds, insertIds, delIds, insertsByPos, delsByPos;
+	vector<unsigned char> snpGroups, snvGroups, insertGroups, delGroups;
+	order.snps.find(segStartPos, segEndPos, snpIds, NULL);
+	order.snvs.find(segStartPos, segEndPos, snvIds, NULL);
+	order.inserts.find(segStartPos, segEndPos, insertIds, &insertsByPos);
+	order.dels.find(segStartPos, segEndPos, delIds, &delsByPos);
+	for(i = 0; i < snpIds.size(); i++) {
+		snpGroups.push_back(VAR_MAJOR+i%2);
+	}
 	k = 0;
-	for(i = 0; i < snvsOfChr.size(); i++) {
-		SNV snv = snvsOfChr[i];
-		long pos = snv.getPosition();
-		if(pos >= segStartPos && pos <= segEndPos) {
-			int sindx = pos-segStartPos;
-			varType type = snv.getType();
-			char alt = snv.getAlt();
-			if(type == homo) {
-				for(j = 0; j < ploidy; j++) {
-					string& segSeq = segSeqs[j];
-					unsigned int segLen = segSeq.length();
-					for(int t = 0; t < segLen/refSize; t++) {
-						segSeq[sindx+t*refSize] = alt;
-					}
-				}
+	for(i = 0; i < snvIds.size(); i++) {
+		snvGroups.push_back(getVarGroup(snvsOfChr[snvIds[i]].getType(), k));
+	}
+	k = 0;
+	for(i = 0; i < insertIds.size(); i++) {
+		insertGroups.push_back(getVarGroup(insertsOfChr[insertIds[i]].getType(), k));
+	}
+	//deletions carry on with the alternation of insertions
+	for(i = 0; i < delIds.size(); i++) {
+		delGroups.push_back(getVarGroup(delsOfChr[delIds[i]].getType(), k));
+	}
+	
+	//substitutions in position order, an SNV overrides an SNP at the same position,
+	//they are only needed when the bases are written
+	vector<pair<unsigned long, char> > subs;
+	if(writer != NULL) {
+		for(i = 0; i < snpIds.size(); i++) {
+			if(hasVariant(snpGroups[i], major)) {
+				subs.push_back(make_pair(snpsOfChr[snpIds[i]].getPosition()-segStartPos, (char) toupper(snpsOfChr[snpIds[i]].getNucleotide())));
 			}
-			else {
-				for(j = 0; j < ploidy; j++) {
-					it = find(mIndx.begin(), mIndx.end(), j);
-					if((k == 0 && it == mIndx.end()) || (k == 1 && it != mIndx.end())) {
-						continue;
-					}
-					string& segSeq = segSeqs[j];
-					unsigned int segLen = segSeq.length();
-					for(int t = 0; t < segLen/refSize; t++) {
-						segSeq[sindx+t*refSize] = alt;
-					}
-				}
-				k = (k+1)%2;
+		}
+		for(i = 0; i < snvIds.size(); i++) {
+			if(hasVariant(snvGroups[i], major)) {
+				subs.push_back(make_pair(snvsOfChr[snvIds[i]].getPosition()-segStartPos, (char) toupper(snvsOfChr[snvIds[i]].getAlt())));
 			}
 		}
+		stable_sort(subs.begin(), subs.end(), subsBefore);
 	}
 	
-	//simu Insert
-	map<int, map<int, int> > insertsPerhaploidy;
-	map<int, int>::iterator m_it;
-	int* insertLens = new int[ploidy];
-	memset(insertLens, 0, ploidy*sizeof(int));
-	k = 0;
-	for(i = 0; i < insertsOfChr.size(); i++) {
-		Insert insert = insertsOfChr[i];
-		long pos = insert.getPosition();
-		if(pos >= segStartPos && pos <= segEndPos) {
-			int sindx = pos-segStartPos;
-			varType type = insert.getType();
-			string seq = insert.getSequence();
-			if(type == homo) {
-				for(j = 0; j < ploidy; j++) {
-					int offset = 0;
-					map<int, int>& insertedSeq = insertsPerhaploidy[j];
-					for(m_it = insertedSeq.begin(); m_it!= insertedSeq.end(); m_it++) {
-						if((*m_it).first <= sindx) {
-							offset += (*m_it).second;
-						}
-					}
-					string& segSeq = segSeqs[j];
-					n = segSeq.length()/(refSize+insertLens[j]);
-					int len = seq.length();
-					for(int t = 0; t < n; t++) {
-						segSeq.insert(sindx+offset+t*(refSize+insertLens[j]+len), seq);
-					}
-					insertLens[j] += seq.length();
-					insertedSeq.insert(make_pair(sindx, seq.length()));
-				}
+	//one pass over the segment for every copy written, an insertion goes before its base, a deletion drops
+	//the bases following its position including inserted ones, overlapping deletions are merged
+	HapWindow window(writer);
+	int passes = (writer != NULL)? copies : 1;
+	unsigned long length = 0;
+	for(k = 0; k < passes; k++) {
+		unsigned long a = 0, b = 0, p = 0, e, skip, pending = 0;
+		size_t s = 0;
+		length = 0;
+		while(p < refSize) {
+			e = refSize;
+			if(a < insertsByPos.size()) {
+				e = min(e, (unsigned long) (insertsOfChr[insertsByPos[a]].getPosition()-segStartPos));
 			}
-			else {
-				for(j = 0; j < ploidy; j++) {
-					it = find(mIndx.begin(), mIndx.end(), j);
-					if((k == 0 && it == mIndx.end()) || (k == 1 && it != mIndx.end())) {
-						continue;
-					}
-					int offset = 0;
-					map<int, int>& insertedSeq = insertsPerhaploidy[j];
-					for(m_it = insertedSeq.begin(); m_it!= insertedSeq.end(); m_it++) {
-						if((*m_it).first <= sindx) {
-							offset += (*m_it).second;
-						}
-					}
-					string& segSeq = segSeqs[j];
-					n = segSeq.length()/(refSize+insertLens[j]);
-					int len = seq.length();
-					for(int t = 0; t < n; t++) {
-						segSeq.insert(sindx+offset+t*(refSize+insertLens[j]+len), seq);
-					}
-					insertLens[j] += seq.length();
-					insertedSeq.insert(make_pair(sindx, seq.length()));
+			if(b < delsByPos.size()) {
+				e = min(e, (unsigned long) (delsOfChr[delsByPos[b]].getPosition()-segStartPos));
+			}
+			if(e > p) {
+				skip = min(pending, e-p);
+				pending -= skip;
+				if(writer != NULL) {
+					window.putReference(chr, segStartPos, p+skip, e-p-skip, subs, s);
 				}
-				k = (k+1)%2;
+				length += e-p-skip;
+				p = e;
+				continue;
 			}
-		}
-	}
-	
-	//simu Del
-	map<int, map<int, int> > delsPerhaploidy;
-	int* delLens = new int[ploidy];
-	memset(delLens, 0, ploidy*sizeof(int));
-	for(i = 0; i < delsOfChr.size(); i++) {
-		Deletion del = delsOfChr[i];
-		long pos = del.getPosition();
-		if(pos >= segStartPos && pos <= segEndPos) {
-			int sindx = pos-segStartPos;
-			varType type = del.getType();
-			int delLen = del.getLength();
-			if(type == homo) {
-				for(j = 0; j < ploidy; j++) {
-					int offset = 0;
-					map<int, int>& insertedSeq = insertsPerhaploidy[j];
-					for(m_it = insertedSeq.begin(); m_it!= insertedSeq.end(); m_it++) {
-						if((*m_it).first <= sindx) {
-							offset += (*m_it).second;
-						}
-					}
-					map<int, int>& delSeq = delsPerhaploidy[j];
-					for(m_it = delSeq.begin(); m_it!= delSeq.end(); m_it++) {
-						if((*m_it).first <= sindx) {
-							offset -= (*m_it).second;
-						}
-					}
-					if(sindx+offset < 0) {
-						continue;
+			for(; a < insertsByPos.size() && (unsigned long) (insertsOfChr[insertsByPos[a]].getPosition()-segStartPos) == p; a++) {
+				if(hasVariant(getGroup(insertIds, insertGroups, insertsByPos[a]), major)) {
+					const string& seq = insertsOfChr[insertsByPos[a]].getSequence();
+					skip = min(pending, (unsigned long) seq.length());
+					pending -= skip;
+					if(writer != NULL) {
+						window.put(seq.data()+skip, seq.length()-skip);
 					}
-					string& segSeq = segSeqs[j];
-					n = segSeq.length()/(refSize+insertLens[j]-delLens[j]);
-					for(int t = 0; t < n; t++) {
-						segSeq.erase(sindx+offset+t*(refSize+insertLens[j]-delLens[j]-delLen), delLen);
-					}
-					delLens[j] += delLen;
-					delSeq.insert(make_pair(sindx, delLen));
+					length += seq.length()-skip;
 				}
 			}
-			else {
-				for(j = 0; j < ploidy; j++) {
-					it = find(mIndx.begin(), mIndx.end(), j);
-					if((k == 0 && it == mIndx.end()) || (k == 1 && it != mIndx.end())) {
-						continue;
-					}
-					int offset = 0;
-					map<int, int>& insertedSeq = insertsPerhaploidy[j];
-					for(m_it = insertedSeq.begin(); m_it!= insertedSeq.end(); m_it++) {
-						if((*m_it).first <= sindx) {
-							offset += (*m_it).second;
-						}
-					}
-					map<int, int>& delSeq = delsPerhaploidy[j];
-					for(m_it = delSeq.begin(); m_it!= delSeq.end(); m_it++) {
-						if((*m_it).first <= sindx) {
-							offset -= (*m_it).second;
-						}
-					}
-					if(sindx+offset < 0) {
-						continue;
-					}
-					string& segSeq = segSeqs[j];
-					n = segSeq.length()/(refSize+insertLens[j]-delLens[j]);
-					for(int t = 0; t < n; t++) {
-						segSeq.erase(sindx+offset+t*(refSize+insertLens[j]-delLens[j]-delLen), delLen);
-					}
-					delLens[j] += delLen;
-					delSeq.insert(make_pair(sindx, delLen));
+			for(; b < delsByPos.size() && (unsigned long) (delsOfChr[delsByPos[b]].getPosition()-segStartPos) == p; b++) {
+				if(hasVariant(getGroup(delIds, delGroups, delsByPos[b]), major)) {
+					pending = max(pending, (unsigned long) delsOfChr[delsByPos[b]].getLength());
 				}
-				k = (k+1)%2;
 			}
 		}
 	}
-	delete[] insertLens;
-	delete[] delLens;
-	
-	for(i = 0; i < ploidy; i++) {
-		if(segSeqs[i].length() > 0) {
-			transform(segSeqs[i].begin(), segSeqs[i].end(), segSeqs[i].begin(), (int (*)(int))toupper);
-		}
-		sequences[i] += segSeqs[i];
-	}
-	
+	window.flush();
+	return length*copies;
 }
 
 void Genome::divideTargets() {
@@ -750,34 +972,96 @@ void Genome::divideTargets() {
 	
 }
 
+void* Genome::batchPack(const void* args) {
+	PackTask* task = (PackTask*) args;
+	PackedSeq& packed = genome.packedGenome;
+	vector<unsigned long>& offsets = genome.chromOffsets;
+	
+	//first touch of the bytes of this part, pieces of chromosomes are packed into them
+	vector<SeqException>& excs = task->exceptions;
+	vector<FastaSpan> spans;
+	vector<char> buffer;
+	packed.clear(task->begin, task->end);
+	for(size_t i = 0; i < genome.chromosomes.size(); i++) {
+		string& chr = genome.chromosomes[i];
+		unsigned long chrLen = genome.getChromLen(chr);
+		unsigned long s = max(task->begin, offsets[i]);
+		unsigned long e = min(task->end, offsets[i]+chrLen);
+		if(s >= e) {
+			continue;
+		}
+		//bases are packed straight from the mapped reference
+		genome.getSubSequenceSpans(chr, s-offsets[i], e-s, spans, buffer);
+		for(size_t k = 0; k < spans.size(); k++) {
+			packed.pack(s, spans[k].data, spans[k].length, excs);
+			s += spans[k].length;
+		}
+	}
+	return NULL;
+}
+
+//****** pack the simulated genome with the worker threads ******//
+void Genome::packGenome() {
+	size_t i;
+	unsigned long total = 0;
+	chromOffsets.clear();
+	for(i = 0; i < chromosomes.size(); i++) {
+		chromOffsets.push_back(total);
+		total += (getChromLen(chromosomes[i])+3)/4*4;
+	}
+	packedGenome.allocate(total);
+	
+	unsigned long j, taskNum = (total+PACK_CHUNK-1)/PACK_CHUNK;
+	PackTask* tasks = new PackTask[taskNum];
+	for(j = 0; j < taskNum; j++) {
+		tasks[j].begin = j*PACK_CHUNK;
+		tasks[j].end = min(total, tasks[j].begin+PACK_CHUNK);
+		threadPool->pool_add_work(&Genome::batchPack, &tasks[j], j);
+	}
+	threadPool->wait();
+	for(j = 0; j < taskNum; j++) {
+		packedGenome.addExceptions(tasks[j].exceptions);
+	}
+	delete[] tasks;
+}
+
+//****** split the genome into fragments, both strands of a locus are views of the packed genome ******//
 void Genome::splitToFrags(vector<Fragment>& fragments) {
 	int i, j, k;
 	int fragLen;
+	packGenome();
 	for(i = 0; i < chromosomes.size(); i++) {
 		string chr = chromosomes[i];
 		long fragStartPos = 1;
 		long chrLen = getChromLen(chr);
+		unsigned long offset = chromOffsets[i]-1;
 		while(fragStartPos <= chrLen) {
 			fragLen = randomInteger(Fragment::minSize, Fragment::maxSize+1);
 			if(fragStartPos+fragLen-1 > chrLen) {
 				break;
 			}
-			Fragment frag1(chr, fragStartPos, fragLen, 1);
+			Fragment frag1(i, offset+fragStartPos, fragStartPos, fragLen, 1);
 			fragments.push_back(frag1);
 			//complementary strand
-			Fragment frag2(chr, fragStartPos, fragLen, -1);
+			Fragment frag2(i, offset+fragStartPos, fragStartPos, fragLen, -1);
 			fragments.push_back(frag2);
 			fragStartPos += fragLen;
 		}
 		if(fragStartPos <= chrLen) {
-			Fragment frag1(chr, fragStartPos, chrLen-fragStartPos+1, 1);
+			Fragment frag1(i, offset+fragStartPos, fragStartPos, chrLen-fragStartPos+1, 1);
 			fragments.push_back(frag1);
-			Fragment frag2(chr, fragStartPos, chrLen-fragStartPos+1, 1);
+			Fragment frag2(i, offset+fragStartPos, fragStartPos, chrLen-fragStartPos+1, 1);
 			fragments.push_back(frag2);
 		}	
 	}
-	for(i = 0; i < fragments.size(); i++) {
-		fragments[i].createSequence();
+	//a fragment with N counts no GC (see countGC)
+	for(size_t n = 0; n < fragments.size(); n++) {
+		Fragment& frag = fragments[n];
+		int gcContent = 0;
+		if(!packedGenome.hasException(frag.getOffset(), frag.getLength(), 'N')) {
+			gcContent = packedGenome.countGC(frag.getOffset(), frag.getLength());
+		}
+		frag.setGCcontent(gcContent);
 	}
 }
 
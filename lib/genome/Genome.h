@@ -14,6 +14,7 @@
 #include "snp.h"
 #include "vcfparser.h"
 #include "Fasta.h"
+#include "PackedSeq.h"
 
 using namespace std;
 
@@ -43,6 +44,65 @@ class Target {
 		long epos;
 };
 
+// variants of a chromosome sorted by position, a segment finds its variants by binary search
+class VariantOrder {
+	private:
+		vector<long> positions;
+		vector<int> indexs;
+		bool sorted;
+		
+		void build(vector<pair<long, int> >& items);
+		
+	public:
+		VariantOrder() {sorted = true;}
+		
+		template<class T> void build(vector<T>& vars) {
+			vector<pair<long, int> > items(vars.size());
+			for(size_t i = 0; i < vars.size(); i++) {
+				items[i] = make_pair((long) vars[i].getPosition(), (int) i);
+			}
+			build(items);
+		}
+		
+		//indexes of the variants at positions [spos, epos] in input order, and in position order if byPos is given
+		void find(long spos, long epos, vector<int>& byInput, vector<int> *byPos) const;
+};
+
+struct ChromVariants {
+	VariantOrder snps;
+	VariantOrder snvs;
+	VariantOrder inserts;
+	VariantOrder dels;
+};
+
+// a segment [spos, epos] of a chromosome, the copies of every haplotype in it and
+// whether a haplotype takes the het variants of the major group
+struct HapSegment {
+	long spos;
+	long epos;
+	vector<int> copies;
+	vector<bool> major;
+};
+
+// the haplotypes of one chromosome simulated by one task, written from offset of the output
+struct HapTask {
+	int chrIndex;
+	vector<HapSegment> segments;
+	vector<unsigned long> lengths;
+	unsigned long offset;
+	int fd;
+	bool seekable;
+};
+
+class FastaWriter;
+
+// part [begin, end) of the packed genome packed by one task
+struct PackTask {
+	unsigned long begin;
+	unsigned long end;
+	vector<SeqException> exceptions;
+};
+
 class Genome {
 	private:
 		vector<string> chromosomes;
@@ -62,6 +122,12 @@ class Genome {
 		string altSequence;
 		string curChr;
 		
+		//simulated genome packed at 2 bits per base, chromosomes start at multiples of 4 bases
+		PackedSeq packedGenome;
+		vector<unsigned long> chromOffsets;
+		//the packed genome is filled by the workers in parts of this many bases, so its pages are spread over their nodes
+		static const unsigned long PACK_CHUNK = 1UL << 22;
+		
 		void loadAbers();
 		void loadSNPs();
 		void loadRefSeq();
@@ -70,7 +136,13 @@ class Genome {
 		void divideTargets();
 		void generateChrSequence(string chr);
 		
-		void generateSegment(vector<string>& sequences, string chr, long segStartPos, long segEndPos, int CN, int mCN);
+		void planSegment(vector<HapSegment>& segments, long segStartPos, long segEndPos, int CN, int mCN);
+		unsigned long generateSegment(HapSegment& seg, string chr, ChromVariants& order, int hap, FastaWriter *writer);
+		static void* batchPlanChrom(const void* args);
+		static void* batchWriteChrom(const void* args);
+		
+		void packGenome();
+		static void* batchPack(const void* args);
 		
 	public:
 		Genome() {curChr = "";}
@@ -98,10 +170,18 @@ class Genome {
 		long getChromLen(string chr);
 		long getGenomeLength();
 		
-		char* getSubSequence(string chr, int startPos, int length);
+		//bases [startPos, startPos+length) of the reference in upper case, copied once into buffer,
+		//returns the null-terminated copy
+		char* getSubSequence(string chr, long startPos, long length, vector<char>& buffer);
+		//the same bases as they are in the reference, views of the mapped file where possible
+		void getSubSequenceSpans(string chr, long startPos, long length, vector<FastaSpan>& spans, vector<char>& buffer);
 		char* getSubRefSequence(string chr, int startPos, int length);
 		char* getSubAltSequence(string chr, int startPos, int length);
 		
+		PackedSeq& getPackedGenome() {return packedGenome;}
+		//the packing task, and so the worker, that filled the part of the packed genome at offset
+		static unsigned long getPackTask(unsigned long offset) {return offset/PACK_CHUNK;}
+		
 		void splitToFrags(vector<Fragment>& fragments);
 };
 
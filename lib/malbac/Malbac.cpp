@@ -8,25 +8,20 @@
 #include <cmath>
 #include <unistd.h>
 #include <algorithm>
+#include <sstream>
 
 #include "MyDefine.h"
 #include "Malbac.h"
 
 Malbac::Malbac() {
-	pthread_mutex_init(&pm_amp, NULL);
-	pthread_mutex_init(&pm_primer, NULL);
-	semiAmplicons = createNullLink();
-	fullAmplicons = createNullLink();
-	primers = NULL;
+	primerCounts = NULL;
 	readNumbers = NULL;
+	cycle = 0;
 }
 
 Malbac::~Malbac() {
-	if(primers != NULL) {
-		for(int i = 0;i < ptypeCount; i++) {
-			delete[] primers[i];
-		}
-		delete[] primers;
+	if(primerCounts != NULL) {
+		delete[] primerCounts;
 	}
 	if(readNumbers != NULL) {
 		delete[] readNumbers;
@@ -34,125 +29,70 @@ Malbac::~Malbac() {
 }
 
 void Malbac::createPrimers() {
-	int i, j, k, n;
-	int tmp[8];
+	int i;
 	string bases = config.getStringPara("bases");
 	int N = bases.length();
 	long primerNum = config.getIntPara("primers");
 	
+	memset(primerCodes, -1, sizeof(primerCodes));
+	for(i = 0; i < N; i++) {
+		primerCodes[(unsigned char) bases[i]] = i;
+	}
+	
 	ptypeCount = pow(N, 8);
-	primers = new char*[ptypeCount];
+	primerCounts = new atomic<long>[ptypeCount];
 	for(i = 0; i < ptypeCount; i++) {
-		primers[i] = new char[9];
-		primers[i][8] = '\0';
+		primerCounts[i].store(primerNum, memory_order_relaxed);
 	}
-	
-	for(i = 0; i < 8; i++) {
-		tmp[i] = 0;
-	}
-	k = 0;
-	while(tmp[0] < N) {
-		PrimerIndex *sIndx = &rIndex;
-		for(i = 0; i < 8; i++) {
-			char c = bases[tmp[i]];
-			primers[k][i] = c;
-			sIndx = &(sIndx->nextIndexs[c]);
-		}
-		sIndx->index = k;
-		sIndx->count = primerNum;
-		k++;
-		n = 1;
-		for(i = 7; i > 0; i--) {
-			if(n == 0) {
-				break;
-			}
-			tmp[i] += n;
-			if(tmp[i] == N) {
-				tmp[i] = 0;
-				n = 1;
-			}
-			else {
-				n = 0;
-			}
+	totalPrimers = ptypeCount*primerNum;
+}
+
+//****** index of the primer matching the 8 bases at s, -1 if a base is not in the alphabet ******//
+int Malbac::getPrimerIndx(const char *s) {
+	static int N = config.getStringPara("bases").length();
+	int indx = 0;
+	for(int i = 0; i < 8; i++) {
+		int code = primerCodes[(unsigned char) s[i]];
+		if(code < 0) {
+			return -1;
 		}
-		tmp[0] += n;
+		indx = indx*N+code;
 	}
-	totalPrimers = k*primerNum;
+	return indx;
 }
 
 long Malbac::getPrimerCount(const char *s) {
-	PrimerIndex *sIndx = &rIndex;
-	for(int i = 0; s[i] != '\0'; i++) {
-		sIndx = &(sIndx->nextIndexs[s[i]]);
+	int indx = getPrimerIndx(s);
+	if(indx < 0) {
+		return 0;
 	}
-	return sIndx->count;
+	return primerCounts[indx].load(memory_order_relaxed);
 }
 
+//****** add n primers of the 8-mer at s to the pool, fails if the count would become negative ******//
 int Malbac::updatePrimerCount(const char *s, int n) {
-	PrimerIndex *sIndx = &rIndex;
-	for(int i = 0; s[i] != '\0'; i++) {
-		sIndx = &(sIndx->nextIndexs[s[i]]);
-	}
-	if(sIndx->count+n < 0) {
+	int indx = getPrimerIndx(s);
+	if(indx < 0) {
 		return 0;
 	}
-	pthread_mutex_lock(&pm_primer);
-	sIndx->count += n;
-	pthread_mutex_unlock(&pm_primer);
+	atomic<long>& count = primerCounts[indx];
+	long cur = count.load(memory_order_relaxed);
+	do {
+		if(cur+n < 0) {
+			return 0;
+		}
+	} while(!count.compare_exchange_weak(cur, cur+n, memory_order_relaxed));
 	return 1;
 }
 
-void Malbac::extendSemiAmplicons(AmpliconLink amplicons) {
-	if(amplicons == NULL) {
-		return;
-	}
-	if(amplicons->link == amplicons) {
-		free(amplicons);
-		return;
-	}
-	pthread_mutex_lock(&pm_amp);
-	AmpliconLink p = amplicons->link;
-	amplicons->link = semiAmplicons->link;
-	semiAmplicons->link = p->link;
-	semiAmplicons = amplicons;
-	Amplicon& amplicon = semiAmplicons->link->amplicon;
-	amplicon.setData(amplicon.getData()+p->amplicon.getData()); // update semi amplicon count
-	free(p);
-	pthread_mutex_unlock(&pm_amp);
-}
-
-void Malbac::extendFullAmplicons(AmpliconLink amplicons) {
-	if(amplicons == NULL) {
-		return;
-	}
-	if(amplicons->link == amplicons) {
-		free(amplicons);
-		return;
-	}
-	pthread_mutex_lock(&pm_amp);
-	AmpliconLink p = amplicons->link;
-	amplicons->link = fullAmplicons->link;
-	fullAmplicons->link = p->link;
-	fullAmplicons = amplicons;
-	Amplicon& amplicon = fullAmplicons->link->amplicon;
-	amplicon.setData(amplicon.getData()+p->amplicon.getData()); // update full amplicon count
-	free(p);
-	pthread_mutex_unlock(&pm_amp);
-}
-
 void Malbac::createFrags() {
 	genome.splitToFrags(fragments);
 }
 
-unsigned long Malbac::getAmpliconCount(AmpliconLink linkList) {
-	return linkList->link->amplicon.getData();
-}
-
 void Malbac::calGCOfRef() {
 	unsigned int i, n = fragments.size();
 	unsigned long gcCount = 0, refLen = 0;
 	for(i = 0; i < n; i++) {
-		char* seq = fragments[i].getSequence();
 		gcCount += fragments[i].getGCcontent();;
 		refLen += fragments[i].getLength();
 	}
@@ -160,12 +100,11 @@ void Malbac::calGCOfRef() {
 }
 
 void Malbac::calGCOfProducts() {
+	unsigned long i, n = fullAmplicons.size();
 	unsigned long gcCount = 0, totalCount = 0;
-	AmpliconLink p = fullAmplicons->link->link;
-	while(p != fullAmplicons->link) {
-		gcCount += p->amplicon.getGCcontent();
-		totalCount += p->amplicon.getLength();
-		p = p->link;
+	for(i = 0; i < n; i++) {
+		gcCount += fullAmplicons[i].getGCcontent();
+		totalCount += fullAmplicons[i].getLength();
 	}
 	cerr << "GCcontent after amp: " << 1.0*gcCount/totalCount << endl;
 }
@@ -180,6 +119,7 @@ void Malbac::amplify() {
 	
 	createPrimers();
 	setPrimers(true);
+	cycle = 0;
 	amplifyFrags();
 	//cerr << getAmpliconCount(semiAmplicons) << endl;
 	for(int i = 0; i < 5; i++) {
@@ -187,6 +127,7 @@ void Malbac::amplify() {
 			break;
 		}
 		cerr << "cycle number: " << i+1 << endl;
+		cycle = i+1;
 		setPrimers(false);
 		amplifySemiAmplicons();
 		//cerr << getAmpliconCount(fullAmplicons) << endl;
@@ -212,12 +153,14 @@ void Malbac::amplifyAndSaveProducts() {
 	cerr << "\nMALBAC amplification..." << endl;
 	createPrimers();
 	setPrimers(true);
+	cycle = 0;
 	amplifyFrags();
 	for(int i = 0; i < 5; i++) {
 		if(totalPrimers == 0) {
 			break;
 		}
 		cerr << "cycle number: " << i+1 << endl;
+		cycle = i+1;
 		setPrimers(false);
 		amplifySemiAmplicons();
 		//cerr << getAmpliconCount(fullAmplicons) << endl;
@@ -231,11 +174,14 @@ void Malbac::amplifyAndSaveProducts() {
 	}
 	
 	ofs.close();
+	semiAmplicons.clear();
+	releaseAmpErrors();
 }
 
 void Malbac::setPrimers(bool onlyFrags) {
 	unsigned long i, j, k;
 	unsigned long templateNum = 0, fragNum = fragments.size();
+	unsigned long semiAmpliconNum = semiAmplicons.size();
 	unsigned int length;
 	double totalLen = 0, lambda;
 	
@@ -246,12 +192,9 @@ void Malbac::setPrimers(bool onlyFrags) {
 	templateNum += fragNum;
 	
 	if(!onlyFrags) {
-		AmpliconLink p = semiAmplicons->link->link;
-		templateNum += getAmpliconCount(semiAmplicons);
-		while(p != semiAmplicons->link) {
-			Amplicon& amplicon = p->amplicon;
-			totalLen += amplicon.getLength();
-			p = p->link;
+		templateNum += semiAmpliconNum;
+		for(i = 0; i < semiAmpliconNum; i++) {
+			totalLen += semiAmplicons[i].getLength();
 		}
 	}
 	
@@ -267,15 +210,13 @@ void Malbac::setPrimers(bool onlyFrags) {
 		fragments[i].setPrimers(k);
 	}
 	if(!onlyFrags) {
-		AmpliconLink p = semiAmplicons->link->link;
-		while(p != semiAmplicons->link) {
-			Amplicon& amplicon = p->amplicon;
+		for(i = 0; i < semiAmpliconNum; i++) {
+			Amplicon& amplicon = semiAmplicons[i];
 			length = amplicon.getLength();
 			lambda = expectedPrimers*(1.0*length/totalLen);
 			k = poissRand(lambda);
 			count += k;
 			amplicon.setPrimers(k);
-			p = p->link;
 		}
 	}
 	
@@ -283,16 +224,24 @@ void Malbac::setPrimers(bool onlyFrags) {
 }
 
 void Malbac::saveFullAmplicons(ofstream& ofs) {
-	unsigned long i = 1, j, k;
-	unsigned long ampliconNum = getAmpliconCount(fullAmplicons);
+	unsigned long i;
+	unsigned long ampliconNum = fullAmplicons.size();
 	char c;
 	char* seq;
 	unsigned int sindx, length;
 	int width = 100;
-	AmpliconLink q, p = fullAmplicons->link->link;
-	while(p != fullAmplicons->link) {
-		ofs << ">" << "amp_" << i++ << endl;
-		seq = p->amplicon.getSequence();
+	Amplicon *semiAmp = NULL;
+	const char *tmplSeq = NULL;
+	for(i = 0; i < ampliconNum; i++) {
+		ofs << ">" << "amp_" << i+1 << endl;
+		if(fullAmplicons[i].getTmpl() != semiAmp) {
+			if(semiAmp != NULL) {
+				Amplicon::releaseTemplate(semiAmp);
+			}
+			semiAmp = (Amplicon*) fullAmplicons[i].getTmpl();
+			tmplSeq = Amplicon::acquireTemplate(semiAmp);
+		}
+		seq = fullAmplicons[i].getSequence(tmplSeq, new char[fullAmplicons[i].getLength()+1]);
 		sindx = 0;
 		length = strlen(seq);
 		while(sindx < length) {
@@ -308,63 +257,56 @@ void Malbac::saveFullAmplicons(ofstream& ofs) {
 			sindx += width;
 		}
 		delete[] seq;
-		q = p;
-		p = p->link;
-		free(q);
 	}
-	p->amplicon.setData(0);
+	if(semiAmp != NULL) {
+		Amplicon::releaseTemplate(semiAmp);
+	}
+	fullAmplicons.clear();
 }
 
-void Malbac::amplifyFrags() {
-	unsigned long sindx = 0;
-	unsigned long fragNum = fragments.size();
-	vector<unsigned long*> threadParas;
-	int i = 0;
-	unsigned long loadPerThread = max((unsigned long) 10, fragNum/threadPool->getThreadNumber());
-	//int loadPerThread = 1000;
-	while(sindx < fragNum) {
-		unsigned long* indxs = new unsigned long[2];
-		if(sindx+loadPerThread > fragNum) {
-			indxs[0] = sindx;
-			indxs[1] = fragNum-1;
-		}
-		else {
-			indxs[0] = sindx;
-			indxs[1] = sindx+loadPerThread-1;
-		}
-		threadPool->pool_add_work(&Fragment::batchAmplify, indxs, i++);
-		threadParas.push_back(indxs);
-		sindx += loadPerThread;
+// run process over the template ranges given by bounds and append their products in task order,
+// a fragment task goes to the worker that packed the genome part its first fragment lies in when home is set
+void Malbac::amplifyTemplates(void* (*process)(const void*), vector<unsigned long>& bounds, AmpliconStore& products, bool home) {
+	unsigned long j, taskNum = bounds.size()-1;
+	if(taskNum == 0) {
+		return;
+	}
+	AmplifyTask* tasks = new AmplifyTask[taskNum];
+	for(j = 0; j < taskNum; j++) {
+		tasks[j].begin = bounds[j];
+		tasks[j].end = bounds[j+1];
+		tasks[j].cycle = cycle;
+		threadPool->pool_add_work(process, &tasks[j], home? genome.getPackTask(fragments[tasks[j].begin].getOffset()) : j);
 	}
 	threadPool->wait();
-	for(i = 0; i < threadParas.size(); i++) {
-		delete[] threadParas[i];
+	for(j = 0; j < taskNum; j++) {
+		products.splice(tasks[j].products);
 	}
+	delete[] tasks;
 }
 
-void Malbac::amplifySemiAmplicons() {
-	unsigned long sindx = 0;
-	unsigned long semiAmpliconNum = getAmpliconCount(semiAmplicons);
-	vector<AmpliconLink*> threadParas;
-	int i = 0, j =0;
-	unsigned long loadPerThread = max((unsigned long) 10, semiAmpliconNum/threadPool->getThreadNumber());
-	AmpliconLink p = semiAmplicons->link->link;
-	while(p != semiAmplicons->link) {
-		AmpliconLink* pNodeRange = new AmpliconLink[2];
-		pNodeRange[0] = p;
-		i = 0;
-		while(i < loadPerThread && p != semiAmplicons->link) {
-			p = p->link;
-			i++;
-		}
-		pNodeRange[1] = p;
-		threadPool->pool_add_work(&Amplicon::batchAmplify, pNodeRange, j++);
-		threadParas.push_back(pNodeRange);
+// the cost of amplifying a template grows with its length and the primers attached to it
+void Malbac::amplifyFrags() {
+	unsigned long i, fragNum = fragments.size();
+	vector<double> costs(fragNum);
+	for(i = 0; i < fragNum; i++) {
+		costs[i] = (double) fragments[i].getLength()*(fragments[i].getPrimers()+1);
 	}
-	threadPool->wait();
-	for(i = 0; i < threadParas.size(); i++) {
-		delete[] threadParas[i];
+	vector<unsigned long> bounds;
+	partitionByCost(costs, FRAGS_PER_TASK, bounds);
+	amplifyTemplates(&Fragment::batchAmplify, bounds, semiAmplicons, true);
+}
+
+void Malbac::amplifySemiAmplicons() {
+	unsigned long i, ampliconNum = semiAmplicons.size();
+	vector<double> costs(ampliconNum);
+	for(i = 0; i < ampliconNum; i++) {
+		Amplicon& amplicon = semiAmplicons[i];
+		costs[i] = (double) amplicon.getLength()*(amplicon.getPrimers()+1);
 	}
+	vector<unsigned long> bounds;
+	partitionByCost(costs, AMPLICONS_PER_TASK, bounds);
+	amplifyTemplates(&Amplicon::batchAmplify, bounds, fullAmplicons, false);
 }
 
 void Malbac::setReadCounts(long reads) {
@@ -372,14 +314,11 @@ void Malbac::setReadCounts(long reads) {
 		delete[] readNumbers;
 	}
 	unsigned long i;
-	unsigned long ampliconNum = getAmpliconCount(fullAmplicons);
+	unsigned long ampliconNum = fullAmplicons.size();
 	Matrix<double> wls(1, ampliconNum);
-	AmpliconLink p = fullAmplicons->link->link;
-	i = 0;
-	while(p != fullAmplicons->link) {
-		double wl = p->amplicon.getWeightedLength();
-		wls.set(0, i++, wl);
-		p = p->link;
+	for(i = 0; i < ampliconNum; i++) {
+		double wl = fullAmplicons[i].getWeightedLength();
+		wls.set(0, i, wl);
 	}
 	wls.normalize(0);
 	
@@ -408,7 +347,8 @@ void Malbac::setReadCounts(long reads) {
 }
 
 void Malbac::yieldReads() {	
-	int i, j = 0;	
+	int i;
+	size_t j;
 	//unsigned long refLen = genome.getGenomeLength()/2;
 	vector<string>& chrs = genome.getChroms();
 	unsigned long refLen = 0;
@@ -424,37 +364,111 @@ void Malbac::yieldReads() {
 	setReadCounts(reads);
 	
 	string fqFilePrefix = config.getStringPara("output");
-	if(config.isPairedEnd()) {
-		string outFile1 = fqFilePrefix+"_1.fq";
-		string outFile2 = fqFilePrefix+"_2.fq";
-		swp = new SeqWriter(outFile1, outFile2);
-	}
-	else {
-		string outFile = fqFilePrefix+".fq";
-		swp = new SeqWriter(outFile);
+	int k, shards = config.getIntPara("shards");
+	unsigned int maxBuffers = 4*threadPool->getThreadNumber()/shards+2;
+	vector<SeqWriter*> writers;
+	for(k = 0; k < shards; k++) {
+		if(shards == 1) {
+			writers.push_back(createWriter(fqFilePrefix, maxBuffers));
+		}
+		else {
+			stringstream ss;
+			ss << fqFilePrefix << "_shard" << k+1;
+			writers.push_back(createWriter(ss.str(), maxBuffers));
+		}
 	}
 	
 	cerr << "\n*****Producing reads*****" << endl;
-	unsigned long ampliconNum = getAmpliconCount(fullAmplicons);
-	vector<AmpliconLink*> threadParas;
-	unsigned long loadPerThread = max((unsigned long) 10, ampliconNum/threadPool->getThreadNumber());
-	AmpliconLink p = fullAmplicons->link->link;
-	while(p != fullAmplicons->link) {
-		AmpliconLink* pNodeRange = new AmpliconLink[2];
-		pNodeRange[0] = p;
-		i = 0;
-		while(i < loadPerThread && p != fullAmplicons->link) {
-			p = p->link;
-			i++;
+	//an amplicon costs its reads plus building its sequence
+	unsigned long ampliconNum = fullAmplicons.size();
+	int readLength = config.getIntPara("readLength");
+	vector<double> costs(ampliconNum);
+	for(j = 0; j < ampliconNum; j++) {
+		costs[j] = (double) readNumbers[j]*readLength+fullAmplicons[j].getLength();
+	}
+	vector<unsigned long> bounds;
+	partitionByCost(costs, AMPLICONS_PER_TASK, bounds);
+	unsigned long rangeNum = bounds.size()-1;
+	AmpliconRange* ranges = new AmpliconRange[rangeNum];
+	//every shard owns a contiguous block of tasks, numbered from 0 within its writer
+	vector<unsigned long> shardTasks(shards+1);
+	vector<unsigned long> shardBegins(shards+1);
+	for(k = 0; k <= shards; k++) {
+		shardTasks[k] = (k*rangeNum+shards-1)/shards;
+		shardBegins[k] = bounds[shardTasks[k]];
+	}
+	for(j = 0, k = 0; j < rangeNum; j++) {
+		ranges[j].begin = bounds[j];
+		ranges[j].end = bounds[j+1];
+		ranges[j].base = ranges[j].begin;
+		while(j >= shardTasks[k+1]) {
+			k++;
 		}
-		pNodeRange[1] = p;
-		threadPool->pool_add_work(&Amplicon::yieldReads, pNodeRange, j++);
-		threadParas.push_back(pNodeRange);
+		ranges[j].task = j-shardTasks[k];
+		ranges[j].writer = writers[k];
+		threadPool->pool_add_work(&Amplicon::yieldReads, &ranges[j], j);
 	}
 	threadPool->wait();
-	for(i = 0; i < threadParas.size(); i++) {
-		delete[] threadParas[i];
+	delete[] ranges;
+	
+	//amplicons are not needed once their reads are written, their error lists go in one sweep
+	fullAmplicons.clear();
+	semiAmplicons.clear();
+	releaseAmpErrors();
+	
+	for(k = 0; k < shards; k++) {
+		writers[k]->close();
 	}
 	
-	delete swp;
+	//the manifest lists the files and read counts of every shard
+	if(shards > 1) {
+		string manifest = fqFilePrefix+".manifest";
+		ofstream ofs;
+		ofs.open(manifest.c_str());
+		if(!ofs.is_open()) {
+			cerr << "Error: cannot open file " << manifest << endl;
+			exit(-1);
+		}
+		ofs << "#shard\tamplicons\treads\tfastq" << endl;
+		for(k = 0; k < shards; k++) {
+			SeqWriter *writer = writers[k];
+			ofs << k+1 << '\t' << shardBegins[k] << '-' << shardBegins[k+1] << '\t' << writer->getReadCount() << '\t' << writer->getFileName(0);
+			if(writer->isPairedEnd()) {
+				ofs << '\t' << writer->getFileName(1);
+			}
+			ofs << endl;
+		}
+		ofs.close();
+	}
+	
+	for(k = 0; k < shards; k++) {
+		delete writers[k];
+	}
+}
+
+//****** create the writer of the fastq files with the given prefix ******//
+SeqWriter* Malbac::createWriter(string fqFilePrefix, unsigned int maxBuffers) {
+	bool ordered = config.getIntPara("ordered") != 0;
+	bool dropCache = config.getIntPara("dropCache") != 0;
+	bool compress = config.getIntPara("compress") != 0;
+	bool interleaved = config.getIntPara("interleaved") != 0;
+	string suffix = compress? ".fq.gz" : ".fq";
+	size_t bufferSize = 4 << 20;
+	//"-" streams the reads to stdout, paired-end reads are then interleaved
+	if(fqFilePrefix == "-") {
+		return new SeqWriter(fqFilePrefix, config.isPairedEnd(), ordered, maxBuffers, bufferSize, dropCache, compress);
+	}
+	else if(config.isPairedEnd() && interleaved) {
+		string outFile = fqFilePrefix+suffix;
+		return new SeqWriter(outFile, true, ordered, maxBuffers, bufferSize, dropCache, compress);
+	}
+	else if(config.isPairedEnd()) {
+		string outFile1 = fqFilePrefix+"_1"+suffix;
+		string outFile2 = fqFilePrefix+"_2"+suffix;
+		return new SeqWriter(outFile1, outFile2, ordered, maxBuffers, bufferSize, dropCache, compress);
+	}
+	else {
+		string outFile = fqFilePrefix+suffix;
+		return new SeqWriter(outFile, false, ordered, maxBuffers, bufferSize, dropCache, compress);
+	}
 }
@@ -8,43 +8,42 @@
 
 #include <vector>
 #include <string>
-#include <pthread.h>
+#include <atomic>
 
 #include "Fragment.h"
 #include "Amplicon.h"
+#include "SeqWriter.h"
 
 using namespace std;
 
-class PrimerIndex {
-	public:
-		int index;
-		long count;
-		map<char, PrimerIndex> nextIndexs;
-		PrimerIndex() {index = -1;}
-};
-
 class Malbac {
 	private:
 		double refGCcontent;
 		unsigned long totalPrimers;
-		char **primers;
+		//remaining primers of every 8-mer, indexed by the 8-mer encoded in base N (2 bits per base for ACGT)
+		atomic<long> *primerCounts;
 		int ptypeCount;
-		PrimerIndex rIndex;
+		signed char primerCodes[256];
 		
 		vector<Fragment> fragments;
 		//vector<Amplicon> semiAmplicons;
 		//vector<Amplicon> fullAmplicons;
-		AmpliconLink semiAmplicons;
-		AmpliconLink fullAmplicons;
+		AmpliconStore semiAmplicons;
+		AmpliconStore fullAmplicons;
 		unsigned int* readNumbers;
 		
-		mutable pthread_mutex_t pm_amp, pm_primer;
+		// average templates per task, tasks are cut by estimated cost (see partitionByCost)
+		// and do not depend on the thread number
+		static const unsigned long FRAGS_PER_TASK = 256;
+		static const unsigned long AMPLICONS_PER_TASK = 1024;
+		int cycle;
 		
 		void createPrimers();
 		
 		void calGCOfRef();
 		void calGCOfProducts();
 		
+		void amplifyTemplates(void* (*process)(const void*), vector<unsigned long>& bounds, AmpliconStore& products, bool home);
 		void amplifyFrags();
 		void amplifySemiAmplicons();
 		
@@ -52,28 +51,26 @@ class Malbac {
 		void saveFullAmplicons(ofstream& ofs);
 		
 		void setReadCounts(long reads);
+		SeqWriter* createWriter(string fqFilePrefix, unsigned int maxBuffers);
 		
 	public:
 		Malbac();
 		~Malbac();
 		
+		int getPrimerIndx(const char *s);
 		long getPrimerCount(const char *s);
 		int updatePrimerCount(const char *s, int n);
 		
 		vector<Fragment>& getFrags() {return fragments;}
 		Fragment& getFrag(unsigned long i) {return fragments[i];}
 		//vector<Amplicon>& getSemiAmplicons() {return semiAmplicons;}
-		AmpliconLink getSemiAmplicons() {return semiAmplicons;}
+		AmpliconStore& getSemiAmplicons() {return semiAmplicons;}
 		//Amplicon& getSemiAmplicon(unsigned long i) {return semiAmplicons[i];}
 		//vector<Amplicon>& getFullAmplicons() {return fullAmplicons;}
-		AmpliconLink getFullAmplicons() {return fullAmplicons;}
-		unsigned long getAmpliconCount(AmpliconLink linkList);
+		AmpliconStore& getFullAmplicons() {return fullAmplicons;}
 		
 		unsigned int* getReadNumbers() {return readNumbers;}
 		
-		void extendSemiAmplicons(AmpliconLink amplicons);
-		void extendFullAmplicons(AmpliconLink amplicons);
-		
 		void createFrags();
 		void amplify();
 		void amplifyAndSaveProducts();
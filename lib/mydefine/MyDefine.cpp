@@ -6,6 +6,7 @@
 #include <vector>
 
 #include "MyDefine.h"
+#include "AliasTable.h"
 
 using namespace std;
 
@@ -24,7 +25,6 @@ Genome genome;
 Malbac malbac;
 Profile profile;
 ThreadPool* threadPool;
-SeqWriter* swp;
 
 //****** normalize matrix ******//
 Matrix<double> norm_trans(Matrix<double> &T, double thres) {
@@ -96,8 +96,6 @@ Matrix<int> randsrc(int m, int n, Matrix<int> alphabet, Matrix<double> aprob, bo
 	else {
 		prob = aprob.cumsum();
 	}
-
-	srand(time(0));
 	
 	ret.resize(m, n, false);
 	int* p = ret.getEntrance();
@@ -152,8 +150,6 @@ Matrix<int> randIndx(int m, int n, Matrix<double> aprob, bool iscdf) {
 	else {
 		prob = aprob.cumsum();
 	}
-
-	srand(time(0));
 	
 	ret.resize(m, n, false);
 	int* p = ret.getEntrance();
@@ -194,16 +190,59 @@ void* batchSampling(const void* args) {
 	unsigned int num_samples = paras[0];
 	unsigned int ac = paras[1];
 	
+	// the stream is keyed by the first index of the block sampled by this task
+	localRandomEngine.setStream(STAGE_READ_COUNTS, (unsigned long) paras[2*ac+2], 0);
+	AliasTable sampler;
+	sampler.buildFromCdf(&paras[ac+2], ac);
 	for(i = 0; i < num_samples; i++) {
-		j = randIndx(&paras[ac+2], ac);
+		j = sampler.sample();
 		paras[j+2]++;
 	}
+	return NULL;
+}
+
+//****** split the items into about n/grain contiguous ranges of equal total cost ******//
+// range j is [bounds[j], bounds[j+1]), no range holds more than 4*grain items
+void partitionByCost(const vector<double>& costs, unsigned long grain, vector<unsigned long>& bounds) {
+	unsigned long i, n = costs.size();
+	unsigned long ranges = (n+grain-1)/grain;
+	double total = 0;
+	for(i = 0; i < n; i++) {
+		total += costs[i];
+	}
+	bounds.clear();
+	bounds.push_back(0);
+	if(n == 0) {
+		return;
+	}
+	//without any cost estimate the ranges are cut by item count
+	if(total <= 0) {
+		for(i = grain; i < n; i += grain) {
+			bounds.push_back(i);
+		}
+		bounds.push_back(n);
+		return;
+	}
+	double target = total/ranges, acc = 0;
+	unsigned long k = 1;
+	for(i = 0; i < n; i++) {
+		acc += costs[i];
+		if(acc >= k*target || i+1-bounds.back() >= 4*grain) {
+			bounds.push_back(i+1);
+			while(k*target <= acc) {
+				k++;
+			}
+		}
+	}
+	if(bounds.back() != n) {
+		bounds.push_back(n);
+	}
 }
 
 unsigned int* randIndx_hp(Matrix<double>& prob, unsigned long n, unsigned int* ret, bool addto) {
 	unsigned int i, j = 0, ac = prob.getCOLS();
 	double* p = prob.getEntrance();
-	unsigned int loadPerThread = max((unsigned int) 1, min((unsigned int) 1000, ac/threadPool->getThreadNumber()));
+	unsigned int loadPerThread = 1000;
 	unsigned int sindx = 0, eindx;
 	unsigned long count = 0;
 	vector<double*> threadParas;
@@ -215,7 +254,7 @@ unsigned int* randIndx_hp(Matrix<double>& prob, unsigned long n, unsigned int* r
 		else {
 			eindx = sindx+loadPerThread-1;
 		}
-		double* paras = new double[(eindx-sindx+1)*2+2];
+		double* paras = new double[(eindx-sindx+1)*2+3];
 		memset(&paras[2], 0, sizeof(double)*(eindx-sindx+1));
 		double totalProb = 0;
 		for(i = sindx; i <= eindx; i++) {
@@ -226,6 +265,7 @@ unsigned int* randIndx_hp(Matrix<double>& prob, unsigned long n, unsigned int* r
 		}
 		paras[0] = (unsigned int) (totalProb*n);
 		paras[1] = eindx-sindx+1;
+		paras[2*(eindx-sindx+1)+2] = sindx;
 		count += paras[0];
 		totalProbs.push_back(totalProb);
 		threadParas.push_back(paras);
@@ -269,10 +309,14 @@ unsigned int* randIndx_hp(Matrix<double>& prob, unsigned long n, unsigned int* r
 		}
 		delete[] paras;
 	}
+	return ret;
 }
 
 unsigned int randIndx(double *cdf, unsigned int ac) {
-	double r = threadPool->randomDouble(ZERO_FINAL, 1);
+	return randIndx(cdf, ac, randomDouble(ZERO_FINAL, 1));
+}
+
+unsigned int randIndx(double *cdf, unsigned int ac, double r) {
 	for(size_t k = 0; k < ac; k++) {
 		if(r <= cdf[k]) {
 			return k;
@@ -281,16 +325,6 @@ unsigned int randIndx(double *cdf, unsigned int ac) {
 	return ac-1;
 }
 
-//****** produce random double ******//
-double randomDouble(double start, double end) {
-	return start+(end-start)*(rand()/(RAND_MAX+1.0));
-}
-
-//****** produce random int ******//
-long randomInteger(long start, long end) {
-	return start+(end-start)*(rand()/(RAND_MAX+1.0));
-}
-
 //****** trim string ******//
 string trim(const string &str, const char *charlist) {
 	string ret(str);
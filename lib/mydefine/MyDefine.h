@@ -15,6 +15,7 @@
 #include "ThreadPool.h"
 #include "SeqWriter.h"
 #include "Matrix.h"
+#include "Random.h"
 
 using namespace std;
 
@@ -33,7 +34,6 @@ extern Genome genome;
 extern Malbac malbac;
 extern Profile profile;
 extern ThreadPool* threadPool;
-extern SeqWriter* swp;
 
 //*** declaration of functions ***//
 Matrix<double> norm_trans(Matrix<double> &T, double thres);
@@ -198,11 +198,11 @@ int randIndx(Matrix<double>& aprob, bool iscdf);
 Matrix<int> randIndx(int m, int n, Matrix<double> aprob, bool iscdf);
 
 unsigned int randIndx(double *cdf, unsigned int ac);
+unsigned int randIndx(double *cdf, unsigned int ac, double r);
 void* batchSampling(const void* args);
 unsigned int* randIndx_hp(Matrix<double>& prob, unsigned long n, unsigned int* ret, bool addto);
 
-double randomDouble(double start, double end);
-long randomInteger(long start, long end);
+void partitionByCost(const vector<double>& costs, unsigned long grain, vector<unsigned long>& bounds);
 
 string trim(const string &str, const char *charlist = " \t\r\n");
 string abbrOfChr(string chr);
@@ -0,0 +1,187 @@
+// ***************************************************************************
+// PackedSeq.cpp (c) 2018 Zhenhua Yu <qasim0208@163.com>
+// Health Informatics Lab, Ningxia University
+// All rights reserved.
+
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <iostream>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <tmmintrin.h>
+#define PACKEDSEQ_SSSE3
+#endif
+
+#include "PackedSeq.h"
+
+static const char BASES[2][4] = {{'A', 'C', 'G', 'T'}, {'T', 'G', 'C', 'A'}};
+
+// four decoded bases of every packed byte, plain and complemented
+static char decodeTable[2][256][4];
+// number of G and C in every packed byte
+static uint8_t gcTable[256];
+static signed char baseCodes[256];
+static bool hasSSSE3 = false;
+
+static bool initTables() {
+	for(int c = 0; c < 256; c++) {
+		gcTable[c] = 0;
+		for(int k = 0; k < 4; k++) {
+			int code = (c >> 2*k) & 3;
+			decodeTable[0][c][k] = BASES[0][code];
+			decodeTable[1][c][k] = BASES[1][code];
+			gcTable[c] += (code == 1 || code == 2);
+		}
+		baseCodes[c] = -1;
+	}
+	for(int k = 0; k < 4; k++) {
+		baseCodes[(unsigned char) BASES[0][k]] = k;
+		baseCodes[(unsigned char) tolower(BASES[0][k])] = k;
+	}
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	hasSSSE3 = __builtin_cpu_supports("ssse3");
+#endif
+	return true;
+}
+
+static bool tablesReady = initTables();
+
+#ifdef PACKEDSEQ_SSSE3
+//****** decode blocks of 16 bytes (64 bases) with pshufb, returns the number of bases written ******//
+__attribute__((target("ssse3")))
+static unsigned long decodeSSSE3(const uint8_t *src, unsigned long blocks, char *out, bool complement) {
+	const __m128i lut = complement? _mm_setr_epi8('T', 'G', 'C', 'A', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0)
+			: _mm_setr_epi8('A', 'C', 'G', 'T', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask = _mm_set1_epi8(3);
+	for(unsigned long b = 0; b < blocks; b++) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (src+16*b));
+		//codes of the k-th base of every byte, 16-bit shifts are safe as only the low 2 bits are kept
+		__m128i c0 = _mm_shuffle_epi8(lut, _mm_and_si128(v, mask));
+		__m128i c1 = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 2), mask));
+		__m128i c2 = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 4), mask));
+		__m128i c3 = _mm_shuffle_epi8(lut, _mm_and_si128(_mm_srli_epi16(v, 6), mask));
+		__m128i lo01 = _mm_unpacklo_epi8(c0, c1), hi01 = _mm_unpackhi_epi8(c0, c1);
+		__m128i lo23 = _mm_unpacklo_epi8(c2, c3), hi23 = _mm_unpackhi_epi8(c2, c3);
+		__m128i *dst = (__m128i*) (out+64*b);
+		_mm_storeu_si128(dst, _mm_unpacklo_epi16(lo01, lo23));
+		_mm_storeu_si128(dst+1, _mm_unpackhi_epi16(lo01, lo23));
+		_mm_storeu_si128(dst+2, _mm_unpacklo_epi16(hi01, hi23));
+		_mm_storeu_si128(dst+3, _mm_unpackhi_epi16(hi01, hi23));
+	}
+	return 64*blocks;
+}
+#endif
+
+PackedSeq::~PackedSeq() {
+	free(data);
+}
+
+void PackedSeq::allocate(unsigned long n) {
+	free(data);
+	//the slack keeps the last block loads inside the allocation
+	data = (uint8_t*) malloc(n/4+64);
+	if(data == NULL) {
+		cerr << "Error: failed to allocate the packed sequence of " << n << " bases!" << endl;
+		exit(-1);
+	}
+	memset(data+n/4, 0, 64);
+	length = n;
+	exceptions.clear();
+}
+
+void PackedSeq::clear(unsigned long begin, unsigned long end) {
+	memset(data+begin/4, 0, (end-begin)/4);
+}
+
+void PackedSeq::pack(unsigned long pos, const char *seq, unsigned long n, vector<SeqException>& excs) {
+	for(unsigned long i = 0; i < n; i++) {
+		int code = baseCodes[(unsigned char) seq[i]];
+		unsigned long p = pos+i;
+		if(code < 0) {
+			char base = toupper(seq[i]);
+			if(!excs.empty() && excs.back().base == base && excs.back().pos+excs.back().len == p) {
+				excs.back().len++;
+			}
+			else {
+				SeqException e = {p, 1, base};
+				excs.push_back(e);
+			}
+			code = 0;
+		}
+		data[p >> 2] |= code << 2*(p & 3);
+	}
+}
+
+void PackedSeq::addExceptions(const vector<SeqException>& excs) {
+	exceptions.insert(exceptions.end(), excs.begin(), excs.end());
+}
+
+static bool exceptionEndsBefore(const SeqException& e, unsigned long pos) {
+	return e.pos+e.len <= pos;
+}
+
+// bases other than ACGT complement to N (see getComplementBase)
+void PackedSeq::patchExceptions(unsigned long pos, unsigned long n, char *out, bool complement) const {
+	vector<SeqException>::const_iterator it = lower_bound(exceptions.begin(), exceptions.end(), pos, exceptionEndsBefore);
+	for(; it != exceptions.end() && it->pos < pos+n; it++) {
+		unsigned long s = max(it->pos, pos), e = min(it->pos+it->len, pos+n);
+		memset(out+s-pos, complement? 'N' : it->base, e-s);
+	}
+}
+
+void PackedSeq::decode(unsigned long pos, unsigned long n, char *out, bool complement) const {
+	const char (*table)[4] = decodeTable[complement];
+	unsigned long i = 0;
+	//bases up to the next byte boundary
+	for(; i < n && ((pos+i) & 3) != 0; i++) {
+		out[i] = table[data[(pos+i) >> 2]][(pos+i) & 3];
+	}
+	const uint8_t *src = data+((pos+i) >> 2);
+#ifdef PACKEDSEQ_SSSE3
+	if(hasSSSE3) {
+		unsigned long k = decodeSSSE3(src, (n-i)/64, out+i, complement);
+		src += k/4;
+		i += k;
+	}
+#endif
+	for(; i+4 <= n; i += 4) {
+		memcpy(out+i, table[*src++], 4);
+	}
+	for(unsigned long k = 0; i < n; i++, k++) {
+		out[i] = table[*src][k];
+	}
+	if(!exceptions.empty()) {
+		patchExceptions(pos, n, out, complement);
+	}
+}
+
+unsigned long PackedSeq::countGC(unsigned long pos, unsigned long n) const {
+	unsigned long i = 0, gc = 0;
+	for(; i < n && ((pos+i) & 3) != 0; i++) {
+		int code = (data[(pos+i) >> 2] >> 2*((pos+i) & 3)) & 3;
+		gc += (code == 1 || code == 2);
+	}
+	const uint8_t *src = data+((pos+i) >> 2);
+	for(; i+4 <= n; i += 4) {
+		gc += gcTable[*src++];
+	}
+	for(unsigned long k = 0; i < n; i++, k++) {
+		int code = (*src >> 2*k) & 3;
+		gc += (code == 1 || code == 2);
+	}
+	return gc;
+}
+
+bool PackedSeq::hasException(unsigned long pos, unsigned long n, char base) const {
+	vector<SeqException>::const_iterator it = lower_bound(exceptions.begin(), exceptions.end(), pos, exceptionEndsBefore);
+	for(; it != exceptions.end() && it->pos < pos+n; it++) {
+		if(it->base == base) {
+			return true;
+		}
+	}
+	return false;
+}
+
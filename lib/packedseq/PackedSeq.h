@@ -0,0 +1,57 @@
+// ***************************************************************************
+// PackedSeq.h (c) 2018 Zhenhua Yu <qasim0208@163.com>
+// Health Informatics Lab, Ningxia University
+// All rights reserved.
+
+#ifndef _PACKEDSEQ_H
+#define _PACKEDSEQ_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+// a run of bases other than ACGT, e.g. N, stored beside the packed codes
+struct SeqException {
+	unsigned long pos;
+	unsigned long len;
+	char base;
+};
+
+// sequence packed at 2 bits per base (A=0, C=1, G=2, T=3), base i sits in bits 2*(i%4) of byte i/4,
+// bases other than ACGT are packed as A and kept as exception runs
+class PackedSeq {
+	private:
+		uint8_t *data;
+		unsigned long length;
+		vector<SeqException> exceptions;
+		
+		void patchExceptions(unsigned long pos, unsigned long n, char *out, bool complement) const;
+	
+	public:
+		PackedSeq() {data = NULL; length = 0;}
+		~PackedSeq();
+		
+		//allocate room for n bases, the pages are first touched by whoever packs them
+		void allocate(unsigned long n);
+		unsigned long size() const {return length;}
+		
+		//zero the bytes of bases [begin, end), both multiples of 4
+		void clear(unsigned long begin, unsigned long end);
+		//pack n bases at pos, lower case bases are packed as upper case ones, the bytes must be zero
+		//and not shared with another thread, exception runs are appended to excs in order
+		void pack(unsigned long pos, const char *seq, unsigned long n, vector<SeqException>& excs);
+		//add exception runs after all runs added so far
+		void addExceptions(const vector<SeqException>& excs);
+		
+		//write bases [pos, pos+n), or their complements, to out
+		void decode(unsigned long pos, unsigned long n, char *out, bool complement) const;
+		
+		//number of G and C in [pos, pos+n)
+		unsigned long countGC(unsigned long pos, unsigned long n) const;
+		bool hasException(unsigned long pos, unsigned long n, char base) const;
+};
+
+#endif
+
@@ -11,7 +11,6 @@
 #include <cmath>
 #include <algorithm>
 #include <ctime>
-#include <chrono>
 #include <unistd.h>
 
 #include "split.h"
@@ -24,6 +23,8 @@ Profile::Profile() {
 	subsCdf1 = subsCdf2 = NULL;
 	qualityDist = qualityCdf = NULL;
 	baseCount = 0;
+	errorTable = subsTable1 = subsTable2 = qualityTable = NULL;
+	tableKmer = 0;
 }
 
 Profile::~Profile() {
@@ -56,6 +57,9 @@ Profile::~Profile() {
 		delete[] qualityDist;
 		delete[] qualityCdf;
 	}
+	if(errorTable != NULL) {
+		free(errorTable);
+	}
 	
 	if(kmers != NULL) {
 		for(i = 0;i < kmerCount; i++) {
@@ -216,7 +220,11 @@ void Profile::init() {
 int Profile::getKmerIndx(const char *s) {
 	KmerIndex *sIndx = &rIndex;
 	for(int i = 0; s[i] != '\0'; i++) {
-		sIndx = &(sIndx->nextIndexs[s[i]]);
+		map<char, KmerIndex>::iterator it = sIndx->nextIndexs.find(s[i]);
+		if(it == sIndx->nextIndexs.end()) {
+			return -1;
+		}
+		sIndx = &(it->second);
 	}
 	return sIndx->index;
 }
@@ -520,6 +528,7 @@ int Profile::countGC(string chr, long position) {
 
 	static int targetIndx = -1;
 	
+	static vector<char> seqBuffer;
 	char* refSeq;
 
 	position -= 1;
@@ -571,7 +580,7 @@ int Profile::countGC(string chr, long position) {
 			}
 			rightPos = min(rightPos, refLen-1);
 			leftPos = rightPos-winSize+1;
-			refSeq = genome.getSubSequence(chr, leftPos, winSize);
+			refSeq = genome.getSubSequence(chr, leftPos, winSize, seqBuffer);
 			rc = 1;
 		}
 		else {
@@ -586,7 +595,7 @@ int Profile::countGC(string chr, long position) {
 				if(targets[targetIndx].epos <= refLen) {
 					rightPos = targets[targetIndx].epos-1;
 					leftPos = targets[targetIndx].spos;
-					refSeq = genome.getSubSequence(chr, leftPos, rightPos-leftPos+1);
+					refSeq = genome.getSubSequence(chr, leftPos, rightPos-leftPos+1, seqBuffer);
 					if(leftPos <= position) {
 						rc = 1;		
 					}
@@ -608,7 +617,6 @@ int Profile::countGC(string chr, long position) {
 		}
 		if(refSeq != NULL) {
 			GC = calculateGCContent(refSeq);
-			delete[] refSeq;
 		}
 		else {
 			GC = -1;
@@ -651,7 +659,7 @@ int Profile::countGC(string chr, long position) {
 				}
 				rightPos = min(rightPos, refLen-1);
 				leftPos = rightPos-winSize+1;
-				refSeq = genome.getSubSequence(chr, leftPos, winSize);
+				refSeq = genome.getSubSequence(chr, leftPos, winSize, seqBuffer);
 				rc = 1;
 			}
 			else {
@@ -665,7 +673,7 @@ int Profile::countGC(string chr, long position) {
 					if(targets[targetIndx].epos <= refLen) {
 						rightPos = targets[targetIndx].epos-1;
 						leftPos = targets[targetIndx].spos;
-						refSeq = genome.getSubSequence(chr, leftPos, rightPos-leftPos+1);
+						refSeq = genome.getSubSequence(chr, leftPos, rightPos-leftPos+1, seqBuffer);
 						if(leftPos <= position) {
 							rc = 1;		
 						}
@@ -688,7 +696,6 @@ int Profile::countGC(string chr, long position) {
 		}
 		if(refSeq != NULL) {
 			GC = calculateGCContent(refSeq);
-			delete[] refSeq;
 		}
 		else {
 			GC = -1;
@@ -1361,7 +1368,7 @@ void Profile::saveResults() {
 }
 
 void Profile::initCDFs() {	
-	unsigned int i, j, l;
+	unsigned int i, j;
 	
 	string bases = config.getStringPara("bases");
 	int N = bases.length();
@@ -1400,15 +1407,6 @@ void Profile::initCDFs() {
 		iSizeCdf = iSizeDist.cumsum();
 		iSizeDist.clear();
 	}
-	
-	//gc
-	for(l = 0; l < 101; l++) {
-		unsigned seed = chrono::system_clock::now().time_since_epoch().count();
-		default_random_engine generator(seed);
-		normal_distribution<double> normal(gcMeans[l], gcStd);
-		gc_generators.push_back(generator);
-		gc_normDists.push_back(normal);
-	}
 
 	//subs
 	for(i = 0; i < kmerCount; i++) {
@@ -1433,6 +1431,131 @@ void Profile::train(string proFile) {
 	load(proFile);
 	normParas(true);
 	initCDFs();
+	compileTables();
+}
+
+void Profile::compileTables() {
+	string bases = config.getStringPara("bases");
+	int kmer = config.getIntPara("kmer");
+	int binCount = config.getIntPara("bins");
+	int N = bases.length();
+	int i, j, l;
+	
+	insAlias.buildFromCdf(insCdf.getEntrance(), insCdf.getCOLS());
+	delAlias.buildFromCdf(delCdf.getEntrance(), delCdf.getCOLS());
+	if(iSizeCdf.getEntrance() != NULL) {
+		iSizeAlias.buildFromCdf(iSizeCdf.getEntrance(), iSizeAlphabet.getCOLS());
+	}
+	
+	for(i = 0; i < 256; i++) {
+		complements[i] = getComplementBase(i);
+	}
+	
+	tableKmer = 0;
+	if(bases.compare("ACGT") != 0 || kmer < 1 || kmer > 5) {
+		return;
+	}
+	
+	memset(baseCodes, -1, sizeof(baseCodes));
+	for(i = 0; i < N; i++) {
+		baseCodes[(unsigned char) bases[i]] = i;
+	}
+	kmerOffsets[1] = 0;
+	for(l = 2; l <= kmer; l++) {
+		kmerOffsets[l] = kmerOffsets[l-1]+(1 << (2*(l-1)));
+	}
+	
+	int baseQualtiyCount = maxBaseQuality-minBaseQuality+1;
+	for(i = 0; i < baseQualtiyCount; i++) {
+		qualityValues[i] = qualityAlphabet.get(0, i);
+	}
+	
+	//quality rows are padded to multiples of 4 entries (64 bytes); the tables share one 64-byte aligned block
+	//and the substitution tables before them hold whole groups of 4 entries, so every row starts on a cache line
+	static_assert(sizeof(AliasEntry) == 16, "a cache line holds 4 alias entries");
+	qualityStride = (baseQualtiyCount+3)/4*4;
+	size_t subsSize = (size_t) kmerCount*binCount*4;
+	size_t qualitySize = (size_t) N*N*binCount*qualityStride;
+	void *p;
+	if(posix_memalign(&p, 64, sizeof(AliasEntry)*(2*subsSize+qualitySize)) != 0) {
+		cerr << "Error: cannot allocate memory for the error model!" << endl;
+		exit(-1);
+	}
+	errorTable = (AliasEntry*) p;
+	subsTable1 = errorTable;
+	subsTable2 = subsTable1+subsSize;
+	qualityTable = subsTable2+subsSize;
+	
+	for(i = 0; i < kmerCount; i++) {
+		double *cdf1 = subsCdf1[i].getEntrance();
+		double *cdf2 = subsCdf2[i].getEntrance();
+		if(cdf2 == NULL) {
+			cdf2 = cdf1;
+		}
+		for(j = 0; j < binCount; j++) {
+			AliasTable::buildFromCdf(cdf1+j*N, N, subsTable1+((size_t) i*binCount+j)*4);
+			AliasTable::buildFromCdf(cdf2+j*N, N, subsTable2+((size_t) i*binCount+j)*4);
+		}
+	}
+	for(i = 0; i < N*N; i++) {
+		double *cdf = qualityCdf[i].getEntrance();
+		for(j = 0; j < binCount; j++) {
+			AliasTable::buildFromCdf(cdf+j*baseQualtiyCount, baseQualtiyCount, qualityTable+((size_t) i*binCount+j)*qualityStride);
+		}
+	}
+	
+	tableKmer = kmer;
+}
+
+//****** sample the read bases and qualities of a source sequence from the compiled tables ******//
+template<int K>
+void Profile::predictBasesK(const char *seq, int n, int isRead1, const double *us, char *readSeq, char *qualitySeq, int nQuality) {
+	static const char bases[] = "ACGT";
+	static int binCount = config.getIntPara("bins");
+	const unsigned int mask = (1U << (2*K))-1;
+	const int qualityCount = maxBaseQuality-minBaseQuality+1;
+	const AliasEntry *subsTable = isRead1? subsTable1 : subsTable2;
+	unsigned int code = 0;
+	int j, b, k, l, valid = 0;
+	for(j = 0; j < n; j++) {
+		b = baseCodes[(unsigned char) seq[j]];
+		if(b < 0) {
+			valid = 0;
+			readSeq[j] = 'N';
+			qualitySeq[j] = (nQuality < 0)? getRandBaseQuality() : nQuality;
+			continue;
+		}
+		code = ((code << 2) | b) & mask;
+		if(valid < K) {
+			valid++;
+		}
+		
+		int binIndx = j*binCount/n;
+		l = (j+1 < K)? j+1 : K;
+		if(valid < l) {
+			//the k-mer contains a base outside the alphabet
+			k = b;
+		}
+		else {
+			int kmerIndx = kmerOffsets[l]+(code & ((1U << (2*l))-1));
+			k = sampleAlias(subsTable+((size_t) kmerIndx*binCount+binIndx)*4, 4, us[2*j]);
+		}
+		readSeq[j] = bases[k];
+		
+		const AliasEntry *row = qualityTable+((size_t) (b*4+k)*binCount+binIndx)*qualityStride;
+		qualitySeq[j] = qualityValues[sampleAlias(row, qualityCount, us[2*j+1])];
+	}
+}
+
+void Profile::predictBases(const char *seq, int n, int isRead1, const double *us, char *readSeq, char *qualitySeq, int nQuality) {
+	switch(tableKmer) {
+		case 1: predictBasesK<1>(seq, n, isRead1, us, readSeq, qualitySeq, nQuality); break;
+		case 2: predictBasesK<2>(seq, n, isRead1, us, readSeq, qualitySeq, nQuality); break;
+		case 3: predictBasesK<3>(seq, n, isRead1, us, readSeq, qualitySeq, nQuality); break;
+		case 4: predictBasesK<4>(seq, n, isRead1, us, readSeq, qualitySeq, nQuality); break;
+		case 5: predictBasesK<5>(seq, n, isRead1, us, readSeq, qualitySeq, nQuality); break;
+		default: predictBasesTrie(seq, n, isRead1, us, readSeq, qualitySeq, nQuality); break;
+	}
 }
 
 void Profile::train() {
@@ -1480,11 +1603,11 @@ void Profile::train() {
 }
 
 int Profile::yieldInsertSize() {
-	if(iSizeAlphabet.getEntrance() == NULL) {
+	if(iSizeAlphabet.getEntrance() == NULL || iSizeAlias.empty()) {
 		return config.getIntPara("insertSize");
 	}
 	
-	int k = randIndx(iSizeCdf.getEntrance(), iSizeAlphabet.getCOLS());
+	int k = iSizeAlias.sample();
 	return iSizeAlphabet.get(0, k);
 }
 
@@ -1505,33 +1628,33 @@ double Profile::getGCFactor(int gc) {
 		return 0;
 	}
 	
-	double v = gc_normDists[gc](gc_generators[gc]);
+	double v = randomNormal(gcMeans[gc], gcStd);
 	while(v < 0) {
-		v = gc_normDists[gc](gc_generators[gc]);
+		v = randomNormal(gcMeans[gc], gcStd);
 	}
 	return v;
 }
 
 int Profile::getInsertLen() {
-	return randIndx(insCdf.getEntrance(), insCdf.getCOLS());
+	return insAlias.sample();
 }
 
 int Profile::getDelLen() {
-	return randIndx(delCdf.getEntrance(), delCdf.getCOLS());
+	return delAlias.sample();
 }
 
-int Profile::getSubBaseIndx1(char *kmerSeq, int binIndx) {
+int Profile::getSubBaseIndx1(char *kmerSeq, int binIndx, double r) {
 	static int N = config.getStringPara("bases").length();
 	static int kmer = config.getIntPara("kmer");
 	int kmerIndx = getKmerIndx(kmerSeq);
 	if(kmerIndx == -1) {
 		return getIndexOfBase(kmerSeq[kmer-1]);
 	}
-	int k = randIndx(subsCdf1[kmerIndx].getEntrance()+binIndx*N, N);
+	int k = randIndx(subsCdf1[kmerIndx].getEntrance()+binIndx*N, N, r);
 	return k;
 }
 
-int Profile::getSubBaseIndx2(char *kmerSeq, int binIndx) {
+int Profile::getSubBaseIndx2(char *kmerSeq, int binIndx, double r) {
 	static int N = config.getStringPara("bases").length();
 	static int kmer = config.getIntPara("kmer");
 	int k;
@@ -1540,227 +1663,163 @@ int Profile::getSubBaseIndx2(char *kmerSeq, int binIndx) {
 		return getIndexOfBase(kmerSeq[kmer-1]);
 	}
 	if(subsCdf2[kmerIndx].getEntrance() == NULL) {
-		int k = randIndx(subsCdf1[kmerIndx].getEntrance()+binIndx*N, N);
+		int k = randIndx(subsCdf1[kmerIndx].getEntrance()+binIndx*N, N, r);
 		return k;
 	}
 	else {
-		int k = randIndx(subsCdf2[kmerIndx].getEntrance()+binIndx*N, N);
+		int k = randIndx(subsCdf2[kmerIndx].getEntrance()+binIndx*N, N, r);
 		return k;
 	}
 }
 
-int Profile::getIndelSeq(vector<int> &baseIndxs) {
-	int i, j, n;
-	static int N = config.getStringPara("bases").length();
-	baseIndxs.clear();
-	double p = threadPool->randomDouble(0, 1);
-	if(p <= insertRate) {
-		n = getInsertLen();
-		for(i = 0; i < n; i++) {
-			j = threadPool->randomInteger(0, N-1);
-			baseIndxs.push_back(j);
-		}
-		return n;
-	}
-	p = threadPool->randomDouble(0, 1);
-	if(p < delRate/(1-insertRate)) {
-		return getDelLen();
-	}
-	return 0;
-}
-
-int Profile::getBaseQuality(int basePairIndx, int binIndx) {
+int Profile::getBaseQuality(int basePairIndx, int binIndx, double r) {
 	static int baseQualtiyCount = maxBaseQuality-minBaseQuality+1;
-	int i = randIndx(qualityCdf[basePairIndx].getEntrance()+binIndx*baseQualtiyCount, baseQualtiyCount);
+	int i = randIndx(qualityCdf[basePairIndx].getEntrance()+binIndx*baseQualtiyCount, baseQualtiyCount, r);
 	return qualityAlphabet.get(0, i);
 }
 
 int Profile::getRandBaseQuality() {
-	return threadPool->randomInteger(minBaseQuality, minBaseQuality+20);
+	return randomInteger(minBaseQuality, minBaseQuality+20);
 }
 
-char* Profile::predict(char* refSeq, int isRead1) {
-	if(refSeq == NULL || refSeq[0] == '\0') {
-		return NULL;
-	}
-	
-	int i, j, k;
-	
+//****** sample the read bases from the k-mer trie, used by profiles that cannot be compiled ******//
+void Profile::predictBasesTrie(const char *seq, int n, int isRead1, const double *us, char *readSeq, char *qualitySeq, int nQuality) {
 	static string bases = config.getStringPara("bases");
 	static int kmer = config.getIntPara("kmer");
 	static int binCount = config.getIntPara("bins");
 	static int N = bases.length();
-	int n = strlen(refSeq);
-	
-	/*
-	for(i = 0; i < n && refSeq[i] == 'N'; i++);
-	for(j = i; j < n && refSeq[j] != 'N'; j++);
-	
-	refSeq = &refSeq[i];
-	n = j-i;
-	*/
-	
-	map<int, vector<int> > indelBaseIndxs;
-	vector<int> indelLens;
-	int indelLength = 0;
-	for(j = 0; j < n;) {
-		k = getIndelSeq(indelBaseIndxs[j]);
-		if(indelBaseIndxs[j].empty() && k > 0) {
-			k = min(n-j, k);
-			indelLength -= k;
-			indelLens.push_back(k);
-			for(i = 1; i < k; i++) {
-				indelLens.push_back(0);
-			}
-			j += k;
-		}
-		else {
-			indelLength += k;
-			j++;
-			indelLens.push_back(k);
-		}
-	}
-	if(n+indelLength < 50) {
-		indelLength = 0;
-		indelBaseIndxs.clear();
-		indelLens.clear();
-		for(j = 0; j < n; j++) {
-			indelLens.push_back(0);
-		}
-	}
+	int i, j, k, refIndx, binIndx;
 	
-	char sourceSeq[n+indelLength+1];
-	int m = 0;
-	for(j = 0; j < n;) {
-		if(indelBaseIndxs[j].empty() && indelLens[j] > 0) {	//del
-			j += indelLens[j];
-			continue;
-		}
-		else if(indelLens[j] == 0) {
-			sourceSeq[m++] = refSeq[j];
-			j++;
-		}
-		else {	//insert
-			sourceSeq[m++] = refSeq[j];
-			vector<int> &indxs = indelBaseIndxs[j];
-			k = indxs.size();
-			for(i = 0; i < k; i++) {
-				sourceSeq[m++] = bases[indxs[i]];
-			}
-			j++;
-		}
-	}
-	sourceSeq[n+indelLength] = '\0';
-	n += indelLength;
-	
-	char seq[kmer+n];
+	static thread_local vector<char> tmp;
+	tmp.resize(kmer+n);
 	for(i = 0; i < kmer-1; i++) {
-		seq[i] = 'X';
+		tmp[i] = 'X';
 	}
 	for(; i < kmer+n-1; i++) {
-		seq[i] = sourceSeq[i-kmer+1];
+		tmp[i] = seq[i-kmer+1];
 	}
 	
-	int refIndx, basePairIndx, binIndx;
-	char *results = new char[2*n+1];
 	for(j = 0; j < n; j++) {
-		refIndx = getIndexOfBase(sourceSeq[j]);
+		refIndx = getIndexOfBase(tmp[j+kmer-1]);
 		binIndx = j*binCount/n;
 		
-		char c = seq[j+kmer];
-		seq[j+kmer] = '\0';
+		char c = tmp[j+kmer];
+		tmp[j+kmer] = '\0';
 		if(isRead1) {
-			k = getSubBaseIndx1(&seq[j], binIndx);
+			k = getSubBaseIndx1(&tmp[j], binIndx, us[2*j]);
 		}
 		else {
-			k = getSubBaseIndx2(&seq[j], binIndx);
+			k = getSubBaseIndx2(&tmp[j], binIndx, us[2*j]);
 		}
-		seq[j+kmer] = c;
+		tmp[j+kmer] = c;
 		if(k == -1) {
-			results[j] = 'N';
+			readSeq[j] = 'N';
+			qualitySeq[j] = (nQuality < 0)? getRandBaseQuality() : nQuality;
 		}
 		else {
-			results[j] = bases[k];
-		}
-		
-		if(k == -1) {
-			results[j+n] = getRandBaseQuality();
+			readSeq[j] = bases[k];
+			qualitySeq[j] = getBaseQuality(refIndx*N+k, binIndx, us[2*j+1]);
 		}
-		else {
-			basePairIndx = refIndx*N+k;
-			results[j+n] = getBaseQuality(basePairIndx, binIndx);
-		}
-		
 	}
-	results[2*n] = '\0';
-	return results;
 }
 
-void Profile::predict(char* refSeq, char* results, int num, int isRead1) {
-	if(refSeq == NULL || refSeq[0] == '\0') {
-		results[0] = '\0';
-		return;
+//****** copy bases [from, to) of the n bases at seq, or of their reverse complement, to dst ******//
+static inline char* copyBases(char *dst, const char *seq, int n, int from, int to, bool rc, const char *complements) {
+	if(rc) {
+		for(int j = from; j < to; j++) {
+			*dst++ = complements[(unsigned char) seq[n-1-j]];
+		}
 	}
-	
-	int i, j, k, quality;
-	
+	else {
+		memcpy(dst, seq+from, to-from);
+		dst += to-from;
+	}
+	return dst;
+}
+
+//****** simulate one read from the n bases of refSeq, returns the length of the read ******//
+int Profile::predictRead(const char *refSeq, int n, int maxLen, int isRead1, bool rc, char *readSeq, char *qualitySeq) {
+	static const int maxIndels = 32;
 	static string bases = config.getStringPara("bases");
-	static int kmer = config.getIntPara("kmer");
-	static int binCount = config.getIntPara("bins");
 	static int N = bases.length();
-	int n = strlen(refSeq);
-	
-	int refIndxs[n];
-	char readSeq[n];
-	char qualitySeq[n];
-	
-	char seq[kmer+n];
-	for(i = 0; i < kmer-1; i++) {
-		seq[i] = 'X';
-	}
-	for(; i < kmer+n-1; i++) {
-		seq[i] = refSeq[i-kmer+1];
-	}
-	
-	for(i = 0; i < n; i++) {
-		refIndxs[i] = getIndexOfBase(refSeq[i]);
-	}
-	
-	int basePairIndx, binIndx;
-	
-	int m = 0;
-	for(i = 0; i < num; i++) {
-		for(j = 0; j < n; j++) {
-			binIndx = j*binCount/n;
-			
-			char c = seq[j+kmer];
-			seq[j+kmer] = '\0';
-			if(isRead1) {
-				k = getSubBaseIndx1(&seq[j], binIndx);
+	int indelPos[maxIndels], indelLens[maxIndels];
+	int i, j, k, m, indelCount = 0, indelLength = 0;
+	
+	//each base starts an insertion with probability insertRate and a deletion with probability delRate,
+	//the bases between two events are skipped with a geometric draw
+	double p = insertRate+delRate;
+	if(p > 0) {
+		double lq = (p < 1)? log(1-p) : 0;
+		j = 0;
+		while(indelCount < maxIndels) {
+			if(p < 1) {
+				double skip = log(randomDouble(ZERO_FINAL, 1))/lq;
+				if(skip >= n-j) {
+					break;
+				}
+				j += (int) skip;
 			}
-			else {
-				k = getSubBaseIndx2(&seq[j], binIndx);
+			if(j >= n) {
+				break;
 			}
-			seq[j+kmer] = c;
-			if(k == -1) {
-				readSeq[j] = 'N';
+			if(randomDouble(0, p) < insertRate) {
+				k = getInsertLen();
+				if(k > 0 && n+indelLength+k <= maxLen) {
+					indelPos[indelCount] = j;
+					indelLens[indelCount++] = k;
+					indelLength += k;
+				}
+				j++;
 			}
 			else {
-				readSeq[j] = bases[k];
-			}
-			
-			if(k == -1) {
-				qualitySeq[j] = minBaseQuality;
+				k = min(n-j, getDelLen());
+				if(k > 0) {
+					indelPos[indelCount] = j;
+					indelLens[indelCount++] = -k;
+					indelLength -= k;
+					j += k;
+				}
+				else {
+					j++;
+				}
 			}
-			else {
-				basePairIndx = refIndxs[j]*N+k;
-				qualitySeq[j] = getBaseQuality(basePairIndx, binIndx);
+		}
+	}
+	if(n+indelLength < 50) {
+		indelCount = 0;
+		indelLength = 0;
+	}
+	
+	//inserted bases follow the base the insertion is placed at, deleted bases start at it
+	char *dst = readSeq;
+	j = 0;
+	for(i = 0; i < indelCount; i++) {
+		dst = copyBases(dst, refSeq, n, j, indelPos[i], rc, complements);
+		j = indelPos[i];
+		if(indelLens[i] > 0) {
+			dst = copyBases(dst, refSeq, n, j, j+1, rc, complements);
+			j++;
+			for(k = 0; k < indelLens[i]; k++) {
+				*dst++ = bases[randomInteger(0, N-1)];
 			}
-			
 		}
-		strncpy(&results[m], readSeq, n);
-		strncpy(&results[m+n], qualitySeq, n);
-		m += 2*n;
+		else {
+			j -= indelLens[i];
+		}
+	}
+	dst = copyBases(dst, refSeq, n, j, n, rc, complements);
+	m = dst-readSeq;
+	
+	static thread_local vector<double> us;
+	us.resize(2*m);
+	localRandomEngine.fillUniform(us.data(), 2*m, ZERO_FINAL, 1);
+	predictBases(readSeq, m, isRead1, us.data(), readSeq, qualitySeq, -1);
+	return m;
+}
+
+void Profile::predict(const char *seq, const long *starts, int num, int n, int maxLen, int isRead1, bool rc, char *results, int *lens) {
+	for(int i = 0; i < num; i++) {
+		char *readSeq = results+(size_t) i*2*maxLen;
+		lens[i] = predictRead(seq+starts[i], n, maxLen, isRead1, rc, readSeq, readSeq+maxLen);
 	}
-	results[m] = '\0';
 }
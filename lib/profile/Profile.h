@@ -9,10 +9,10 @@
 #include <vector>
 #include <map>
 #include <string>
-#include <random>
 #include <pthread.h>
 
 #include "Matrix.h"
+#include "AliasTable.h"
 
 using namespace std;
 
@@ -64,12 +64,34 @@ class Profile {
 		//GC-content bias
 		double gcMeans[101];
 		double gcStd;
-		vector<default_random_engine> gc_generators;
-		vector<normal_distribution<double> > gc_normDists;
 		
 		vector<double> gcs;
 		vector<double> readCounts;
 		
+		//alias samplers of insert size, insertion length and deletion length
+		AliasTable iSizeAlias;
+		AliasTable insAlias;
+		AliasTable delAlias;
+		
+		//error model compiled into one flat table of alias rows for the ACGT alphabet and k <= 5,
+		//rows are indexed by the rolling 2-bit code of the k-mer and the position bin
+		AliasEntry *errorTable;
+		AliasEntry *subsTable1;
+		AliasEntry *subsTable2;
+		AliasEntry *qualityTable;
+		int qualityStride;
+		int tableKmer;
+		int kmerOffsets[6];
+		signed char baseCodes[256];
+		int qualityValues[128];
+		char complements[256];
+		
+		void compileTables();
+		void predictBases(const char *seq, int n, int isRead1, const double *us, char *readSeq, char *qualitySeq, int nQuality);
+		template<int K> void predictBasesK(const char *seq, int n, int isRead1, const double *us, char *readSeq, char *qualitySeq, int nQuality);
+		void predictBasesTrie(const char *seq, int n, int isRead1, const double *us, char *readSeq, char *qualitySeq, int nQuality);
+		int predictRead(const char *refSeq, int n, int maxLen, int isRead1, bool rc, char *readSeq, char *qualitySeq);
+		
 		void initKmers();
 		void setReadLength();
 		int getKmerIndx(const char *s);
@@ -86,10 +108,9 @@ class Profile {
 
 		int getInsertLen();
 		int getDelLen();
-		int getSubBaseIndx1(char *kmer, int binIndx);
-		int getSubBaseIndx2(char *kmer, int binIndx);
-		int getIndelSeq(vector<int> &baseIndxs);
-		int getBaseQuality(int basePairIndx, int binIndx);
+		int getSubBaseIndx1(char *kmer, int binIndx, double r);
+		int getSubBaseIndx2(char *kmer, int binIndx, double r);
+		int getBaseQuality(int basePairIndx, int binIndx, double r);
 		int getRandBaseQuality();
 		
 	public:
@@ -108,8 +129,9 @@ class Profile {
 		
 		void train(string proFile);
 		void train();
-		char* predict(char* refSeq, int isRead1);
-		void predict(char* refSeq, char* results, int num, int isRead1);
+		//simulate num reads, read i from the n bases at seq+starts[i] (their reverse complement if rc is set),
+		//its bases and qualities are stored at results+2*i*maxLen and results+(2*i+1)*maxLen and its length in lens[i]
+		void predict(const char *seq, const long *starts, int num, int n, int maxLen, int isRead1, bool rc, char *results, int *lens);
 		
 };
 
@@ -0,0 +1,90 @@
+// ***************************************************************************
+// AliasTable.cpp (c) 2018 Zhenhua Yu <qasim0208@163.com>
+// Health Informatics Lab, Ningxia University
+// All rights reserved.
+
+#include "AliasTable.h"
+
+void AliasTable::build(const double *weights, int n, AliasEntry *entries) {
+	int i, s, l;
+	size_t j;
+	double total = 0;
+	for(i = 0; i < n; i++) {
+		if(weights[i] > 0) {
+			total += weights[i];
+		}
+	}
+	if(total <= 0) {
+		//no mass at all, every draw falls on the last entry like the linear scan in randIndx
+		for(i = 0; i < n; i++) {
+			entries[i].prob = 0;
+			entries[i].alias = n-1;
+		}
+		entries[n-1].prob = 1;
+		return;
+	}
+	
+	vector<double> scaled(n);
+	vector<int> small, large;
+	for(i = 0; i < n; i++) {
+		scaled[i] = (weights[i] > 0)? weights[i]*n/total : 0;
+		if(scaled[i] < 1) {
+			small.push_back(i);
+		}
+		else {
+			large.push_back(i);
+		}
+	}
+	while(!small.empty() && !large.empty()) {
+		s = small.back();
+		small.pop_back();
+		l = large.back();
+		entries[s].prob = scaled[s];
+		entries[s].alias = l;
+		scaled[l] -= 1-scaled[s];
+		if(scaled[l] < 1) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	//what is left is 1 up to rounding errors
+	for(j = 0; j < large.size(); j++) {
+		entries[large[j]].prob = 1;
+		entries[large[j]].alias = large[j];
+	}
+	for(j = 0; j < small.size(); j++) {
+		entries[small[j]].prob = 1;
+		entries[small[j]].alias = small[j];
+	}
+}
+
+// the table gives the same distribution as randIndx(cdf, n) with r drawn from (0, 1]
+void AliasTable::buildFromCdf(const double *cdf, int n, AliasEntry *entries) {
+	vector<double> weights(n);
+	double prev = 0;
+	for(int i = 0; i < n; i++) {
+		double c = (cdf[i] > prev)? cdf[i] : prev;
+		weights[i] = c-prev;
+		prev = c;
+	}
+	if(prev < 1) {
+		weights[n-1] += 1-prev;
+	}
+	build(&weights[0], n, entries);
+}
+
+void AliasTable::build(const double *weights, int n) {
+	entries.resize(n);
+	if(n <= 0) {
+		return;
+	}
+	build(weights, n, &entries[0]);
+}
+
+void AliasTable::buildFromCdf(const double *cdf, int n) {
+	entries.resize(n);
+	if(n <= 0) {
+		return;
+	}
+	buildFromCdf(cdf, n, &entries[0]);
+}
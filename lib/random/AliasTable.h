@@ -0,0 +1,56 @@
+// ***************************************************************************
+// AliasTable.h (c) 2018 Zhenhua Yu <qasim0208@163.com>
+// Health Informatics Lab, Ningxia University
+// All rights reserved.
+
+#ifndef _ALIASTABLE_H
+#define _ALIASTABLE_H
+
+#include <vector>
+
+#include "Random.h"
+
+using namespace std;
+
+// one column of an alias table: keep the column with probability prob, otherwise take alias
+struct AliasEntry {
+	double prob;
+	int alias;
+};
+
+//****** draw an index from n alias entries with a uniform number u in [0, 1] ******//
+inline int sampleAlias(const AliasEntry *entries, int n, double u) {
+	double x = u*n;
+	int i = (int) x;
+	if(i >= n) {
+		i = n-1;
+	}
+	return (x-i < entries[i].prob)? i : entries[i].alias;
+}
+
+// Walker's alias method (Vose's construction), O(1) draws from a discrete distribution
+class AliasTable {
+	private:
+		vector<AliasEntry> entries;
+		
+	public:
+		AliasTable() {}
+		
+		static void build(const double *weights, int n, AliasEntry *entries);
+		static void buildFromCdf(const double *cdf, int n, AliasEntry *entries);
+		
+		void build(const double *weights, int n);
+		void buildFromCdf(const double *cdf, int n);
+		
+		int size() const {return entries.size();}
+		bool empty() const {return entries.empty();}
+		
+		inline int sample(double u) const {
+			return sampleAlias(&entries[0], entries.size(), u);
+		}
+		inline int sample() const {
+			return sample(localRandomEngine.nextDouble());
+		}
+};
+
+#endif
@@ -0,0 +1,125 @@
+// ***************************************************************************
+// Random.cpp (c) 2018 Zhenhua Yu <qasim0208@163.com>
+// Health Informatics Lab, Ningxia University
+// All rights reserved.
+
+#include <cmath>
+#include <pthread.h>
+
+#include "Random.h"
+
+__thread RandomEngine localRandomEngine;
+
+uint64_t RandomEngine::baseSeed = 0x5DEECE66DULL;
+
+static unsigned long threadCount = 0;
+static pthread_mutex_t pm_seed = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t splitmix64(uint64_t& x) {
+	uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30))*0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27))*0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+//****** Philox4x32-10 counter-based generator ******//
+void philox4x32(uint32_t ctr[4], const uint32_t key[2]) {
+	uint32_t k0 = key[0], k1 = key[1];
+	for(int r = 0; r < 10; r++) {
+		uint64_t p0 = (uint64_t) 0xD2511F53U*ctr[0];
+		uint64_t p1 = (uint64_t) 0xCD9E8D57U*ctr[2];
+		uint32_t c0 = (uint32_t) (p1 >> 32) ^ ctr[1] ^ k0;
+		uint32_t c2 = (uint32_t) (p0 >> 32) ^ ctr[3] ^ k1;
+		ctr[0] = c0;
+		ctr[1] = (uint32_t) p1;
+		ctr[2] = c2;
+		ctr[3] = (uint32_t) p0;
+		k0 += 0x9E3779B9U;
+		k1 += 0xBB67AE85U;
+	}
+}
+
+void RandomEngine::seed(uint64_t seed) {
+	for(int i = 0; i < 4; i++) {
+		s[i] = splitmix64(seed);
+	}
+	seeded = true;
+}
+
+// each thread gets its own stream derived from the base seed
+void RandomEngine::seedThread() {
+	pthread_mutex_lock(&pm_seed);
+	unsigned long k = threadCount++;
+	pthread_mutex_unlock(&pm_seed);
+	seed(baseSeed ^ (k*0xD1B54A32D192ED03ULL));
+}
+
+// restart the engine on the stream keyed by (base seed, stage, id1, id2),
+// so that the numbers drawn for a work item do not depend on the thread running it
+void RandomEngine::setStream(unsigned int stage, uint64_t id1, uint64_t id2) {
+	uint32_t key[2] = {(uint32_t) baseSeed, (uint32_t) (baseSeed >> 32)};
+	for(int b = 0; b < 2; b++) {
+		uint32_t ctr[4];
+		ctr[0] = (uint32_t) id1;
+		ctr[1] = (uint32_t) (id1 >> 32);
+		ctr[2] = (uint32_t) id2;
+		ctr[3] = ((uint32_t) (id2 >> 32) << 8) | ((stage & 0x3F) << 2) | b;
+		philox4x32(ctr, key);
+		s[2*b] = ((uint64_t) ctr[1] << 32) | ctr[0];
+		s[2*b+1] = ((uint64_t) ctr[3] << 32) | ctr[2];
+	}
+	if((s[0] | s[1] | s[2] | s[3]) == 0) {
+		s[0] = 1;
+	}
+	seeded = true;
+}
+
+void RandomEngine::setBaseSeed(uint64_t seed) {
+	pthread_mutex_lock(&pm_seed);
+	baseSeed = seed;
+	threadCount = 0;
+	pthread_mutex_unlock(&pm_seed);
+	localRandomEngine.seedThread();
+}
+
+double RandomEngine::nextNormal(double mu, double sigma) {
+	double u, v, r;
+	do {
+		u = 2*nextDouble()-1;
+		v = 2*nextDouble()-1;
+		r = u*u+v*v;
+	} while(r >= 1 || r == 0);
+	return mu+sigma*u*sqrt(-2*log(r)/r);
+}
+
+void RandomEngine::fillUniform(double *buf, size_t n, double start, double end) {
+	double w = end-start;
+	for(size_t i = 0; i < n; i++) {
+		buf[i] = start+w*nextDouble();
+	}
+}
+
+void RandomEngine::fillNormal(double *buf, size_t n, double mu, double sigma) {
+	double u, v, r;
+	size_t i = 0;
+	while(i < n) {
+		u = 2*nextDouble()-1;
+		v = 2*nextDouble()-1;
+		r = u*u+v*v;
+		if(r >= 1 || r == 0) {
+			continue;
+		}
+		r = sqrt(-2*log(r)/r);
+		buf[i++] = mu+sigma*u*r;
+		if(i < n) {
+			buf[i++] = mu+sigma*v*r;
+		}
+	}
+}
+
+void RandomEngine::fillInteger(long *buf, size_t n, long start, long end) {
+	double w = end-start;
+	for(size_t i = 0; i < n; i++) {
+		buf[i] = start+(long) (w*nextDouble());
+	}
+}
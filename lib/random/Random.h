@@ -0,0 +1,89 @@
+// ***************************************************************************
+// Random.h (c) 2018 Zhenhua Yu <qasim0208@163.com>
+// Health Informatics Lab, Ningxia University
+// All rights reserved.
+
+#ifndef _RANDOM_H
+#define _RANDOM_H
+
+#include <cstddef>
+#include <stdint.h>
+
+using namespace std;
+
+// stages of a simulation that draw from keyed streams (see RandomEngine::setStream)
+enum RandomStage {
+	STAGE_FRAG_AMPLIFY = 1,
+	STAGE_SEMI_AMPLIFY = 2,
+	STAGE_READ_COUNTS = 3,
+	STAGE_READS = 4,
+	STAGE_HAPLOTYPES = 5
+};
+
+void philox4x32(uint32_t ctr[4], const uint32_t key[2]);
+
+// xoshiro256** generator, every thread owns one instance (see localRandomEngine)
+class RandomEngine {
+	private:
+		uint64_t s[4];
+		bool seeded;
+
+		static uint64_t baseSeed;
+
+		static inline uint64_t rotl(uint64_t x, int k) {
+			return (x << k) | (x >> (64-k));
+		}
+
+		void seedThread();
+
+	public:
+		void seed(uint64_t seed);
+		void setStream(unsigned int stage, uint64_t id1, uint64_t id2);
+
+		static void setBaseSeed(uint64_t seed);
+		static uint64_t getBaseSeed() {return baseSeed;}
+
+		inline uint64_t next() {
+			if(!seeded) {
+				seedThread();
+			}
+			uint64_t result = rotl(s[1]*5, 7)*9;
+			uint64_t t = s[1] << 17;
+			s[2] ^= s[0];
+			s[3] ^= s[1];
+			s[1] ^= s[2];
+			s[0] ^= s[3];
+			s[2] ^= t;
+			s[3] = rotl(s[3], 45);
+			return result;
+		}
+
+		// uniform number in [0, 1)
+		inline double nextDouble() {
+			return (next() >> 11)*(1.0/9007199254740992.0);
+		}
+
+		double nextNormal(double mu, double sigma);
+
+		void fillUniform(double *buf, size_t n, double start, double end);
+		void fillNormal(double *buf, size_t n, double mu, double sigma);
+		void fillInteger(long *buf, size_t n, long start, long end);
+};
+
+extern __thread RandomEngine localRandomEngine;
+
+//****** produce random double in [start, end) ******//
+inline double randomDouble(double start, double end) {
+	return start+(end-start)*localRandomEngine.nextDouble();
+}
+
+//****** produce random integer in [start, end) ******//
+inline long randomInteger(long start, long end) {
+	return start+(long) ((end-start)*localRandomEngine.nextDouble());
+}
+
+inline double randomNormal(double mu, double sigma) {
+	return localRandomEngine.nextNormal(mu, sigma);
+}
+
+#endif
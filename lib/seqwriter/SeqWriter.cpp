@@ -4,61 +4,353 @@
 // All rights reserved.
 
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
 #include <iostream>
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
 
 #include "SeqWriter.h"
 
+// written data is flushed and dropped from the page cache in windows of this size
+static const off_t SYNC_WINDOW = 64L << 20;
 
-SeqWriter::SeqWriter(string seFile) {
-	se_ofs.open(seFile.c_str());
-	if(!se_ofs.is_open()) {
-		cerr << "Error: can not open fastq file to save results:\n" << seFile << endl;
-		exit(-1);
+// BGZF blocks take at most this much input so that a block never exceeds 64 KB
+static const size_t BGZF_BLOCK_INPUT = 0xff00;
+static const size_t BGZF_MAX_BLOCK = 0x10000;
+static const size_t BGZF_HEADER = 18;
+static const size_t BGZF_FOOTER = 8;
+static const unsigned char BGZF_EOF[28] = {
+	0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+	0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static inline void packUInt16(unsigned char *p, unsigned int v) {
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static inline void packUInt32(unsigned char *p, unsigned long v) {
+	packUInt16(p, v & 0xffff);
+	packUInt16(p+2, (v >> 16) & 0xffff);
+}
+
+//****** compress n bytes of src into BGZF blocks at dst, returns the compressed size ******//
+static size_t bgzfCompress(const char *src, size_t n, char *dst) {
+	size_t zlen = 0;
+	while(n > 0) {
+		size_t k = (n < BGZF_BLOCK_INPUT)? n : BGZF_BLOCK_INPUT;
+		unsigned char *block = (unsigned char*) dst+zlen;
+		
+		z_stream zs;
+		memset(&zs, 0, sizeof(zs));
+		if(deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			cerr << "Error: failed to initialize the BGZF compressor!" << endl;
+			exit(-1);
+		}
+		zs.next_in = (Bytef*) src;
+		zs.avail_in = k;
+		zs.next_out = block+BGZF_HEADER;
+		zs.avail_out = BGZF_MAX_BLOCK-BGZF_HEADER-BGZF_FOOTER;
+		if(deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+			cerr << "Error: failed to compress a BGZF block!" << endl;
+			exit(-1);
+		}
+		size_t bsize = BGZF_HEADER+zs.total_out+BGZF_FOOTER;
+		deflateEnd(&zs);
+		
+		//gzip header with the BC extra field holding the block size
+		memcpy(block, BGZF_EOF, 16);
+		packUInt16(block+16, bsize-1);
+		unsigned char *footer = block+bsize-BGZF_FOOTER;
+		packUInt32(footer, crc32(crc32(0, Z_NULL, 0), (const Bytef*) src, k));
+		packUInt32(footer+4, k);
+		
+		zlen += bsize;
+		src += k;
+		n -= k;
+	}
+	return zlen;
+}
+
+SeqBuffer::SeqBuffer(size_t capacity, bool pe, bool compress) : capacity(capacity) {
+	data[0] = new char[capacity];
+	data[1] = pe? new char[capacity] : NULL;
+	len[0] = len[1] = 0;
+	zdata[0] = zdata[1] = NULL;
+	zlen[0] = zlen[1] = 0;
+	if(compress) {
+		size_t zcapacity = (capacity+BGZF_BLOCK_INPUT-1)/BGZF_BLOCK_INPUT*BGZF_MAX_BLOCK;
+		zdata[0] = new char[zcapacity];
+		zdata[1] = pe? new char[zcapacity] : NULL;
+	}
+	task = chunk = records = 0;
+	last = false;
+}
+
+SeqBuffer::~SeqBuffer() {
+	for(int i = 0; i < 2; i++) {
+		if(data[i] != NULL) {
+			delete[] data[i];
+		}
+		if(zdata[i] != NULL) {
+			delete[] zdata[i];
+		}
+	}
+}
+
+void SeqBuffer::compress() {
+	for(int i = 0; i < 2; i++) {
+		zlen[i] = (zdata[i] != NULL)? bgzfCompress(data[i], len[i], zdata[i]) : 0;
 	}
-	pe = false;
-	pthread_mutex_init(&pm, NULL);
 }
 
-SeqWriter::SeqWriter(string peFile1, string peFile2) {
-	pe_ofs1.open(peFile1.c_str());
-	if(!pe_ofs1.is_open()) {
-		cerr << "Error: can not open fastq file to save results:\n" << peFile1 << endl;
+void SeqFile::open(string fileName) {
+	if(fileName == "-") {
+		name = "stdout";
+		fd = STDOUT_FILENO;
+	}
+	else {
+		//opening a named pipe blocks until its reader opens it
+		name = fileName;
+		fd = ::open(fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if(fd < 0) {
+		cerr << "Error: can not open fastq file to save results:\n" << fileName << endl;
 		exit(-1);
 	}
-	pe_ofs2.open(peFile2.c_str());
-	if(!pe_ofs2.is_open()) {
-		cerr << "Error: can not open fastq file to save results:\n" << peFile2 << endl;
+	struct stat st;
+	regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+	written = synced = 0;
+#ifdef POSIX_FADV_SEQUENTIAL
+	if(regular) {
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+#endif
+}
+
+void SeqFile::write(const char *buf, size_t n, bool dropCache) {
+	while(n > 0) {
+		ssize_t k = ::write(fd, buf, n);
+		if(k < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			//workers may still be running and using the global objects, so leave without the exit handlers
+			if(errno == EPIPE) {
+				cerr << "Error: the reader of " << name << " has closed the stream!" << endl;
+				_exit(-1);
+			}
+			cerr << "Error: failed to write fastq file " << name << ": " << strerror(errno) << endl;
+			exit(-1);
+		}
+		buf += k;
+		n -= k;
+		written += k;
+	}
+	if(!dropCache || !regular || written-synced < 2*SYNC_WINDOW) {
+		return;
+	}
+	//start writeback of the last window and drop the one before, which has been written back by now
+#ifdef SYNC_FILE_RANGE_WRITE
+	sync_file_range(fd, synced+SYNC_WINDOW, written-synced-SYNC_WINDOW, SYNC_FILE_RANGE_WRITE);
+	sync_file_range(fd, synced, SYNC_WINDOW, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#ifdef POSIX_FADV_DONTNEED
+	posix_fadvise(fd, synced, SYNC_WINDOW, POSIX_FADV_DONTNEED);
+#endif
+	synced += SYNC_WINDOW;
+}
+
+void SeqFile::close() {
+	if(fd < 0) {
+		return;
+	}
+	if(::close(fd) != 0) {
+		cerr << "Error: failed to close fastq file " << name << ": " << strerror(errno) << endl;
 		exit(-1);
 	}
+	fd = -1;
+}
+
+SeqWriter::SeqWriter(string outFile, bool interleaved, bool ordered, unsigned int maxBuffers, size_t bufferSize, bool dropCache, bool compress) {
+	files[0].open(outFile);
+	files[1].fd = -1;
+	pe = false;
+	this->interleaved = interleaved;
+	init(ordered, maxBuffers, bufferSize, dropCache, compress);
+}
+
+SeqWriter::SeqWriter(string peFile1, string peFile2, bool ordered, unsigned int maxBuffers, size_t bufferSize, bool dropCache, bool compress) {
+	files[0].open(peFile1);
+	files[1].open(peFile2);
 	pe = true;
-	pthread_mutex_init(&pm, NULL);
+	interleaved = false;
+	init(ordered, maxBuffers, bufferSize, dropCache, compress);
 }
 
 SeqWriter::~SeqWriter() {
 	close();
+	for(size_t i = 0; i < buffers.size(); i++) {
+		delete buffers[i];
+	}
+}
+
+void SeqWriter::init(bool ordered, unsigned int maxBuffers, size_t bufferSize, bool dropCache, bool compress) {
+	this->ordered = ordered;
+	this->compress = compress;
+	this->maxBuffers = maxBuffers;
+	this->bufferSize = bufferSize;
+	this->dropCache = dropCache;
+	closing = false;
+	records = 0;
+	headTask = headChunk = 0;
+	//a closed pipe is reported by write(2) as EPIPE instead of killing the process
+	signal(SIGPIPE, SIG_IGN);
+	pthread_mutex_init(&pm, NULL);
+	pthread_cond_init(&queueCond, NULL);
+	pthread_cond_init(&freeCond, NULL);
+	if(pthread_create(&writer, NULL, &SeqWriter::run, this) != 0) {
+		cerr << "Error: failed to create the writer thread!" << endl;
+		exit(-1);
+	}
+}
+
+//****** get an empty buffer, blocks while all buffers are in use ******//
+SeqBuffer* SeqWriter::getBuffer(unsigned long task, unsigned long chunk) {
+	SeqBuffer *buf;
+	pthread_mutex_lock(&pm);
+	if(ordered) {
+		runningTasks.insert(task);
+	}
+	while(freeBuffers.empty()) {
+		//the task the ordered output waits for must not block, or the writer could never free a buffer;
+		//the others may only wait for it while it runs, as it could be queued behind them, e.g. when all
+		//workers wait here, so they allocate past the limit until it has started
+		if(buffers.size() < maxBuffers || (ordered && (task == headTask || runningTasks.count(headTask) == 0))) {
+			buf = new SeqBuffer(bufferSize, pe, compress);
+			buffers.push_back(buf);
+			freeBuffers.push_back(buf);
+			break;
+		}
+		pthread_cond_wait(&freeCond, &pm);
+	}
+	buf = freeBuffers.back();
+	freeBuffers.pop_back();
+	pthread_mutex_unlock(&pm);
+	
+	buf->len[0] = buf->len[1] = 0;
+	buf->task = task;
+	buf->chunk = chunk;
+	buf->records = 0;
+	buf->last = false;
+	return buf;
 }
 
-void SeqWriter::write(char* str) {
-	//printf("thread 0x%x go in\n", pthread_self());
+//****** hand a filled buffer to the writer thread, compressed output is compressed by the caller ******//
+void SeqWriter::submit(SeqBuffer *buf, bool last) {
+	buf->last = last;
+	if(compress) {
+		buf->compress();
+	}
 	pthread_mutex_lock(&pm);
-	se_ofs << str;
+	if(ordered) {
+		pending[make_pair(buf->task, buf->chunk)] = buf;
+	}
+	else {
+		queue.push_back(buf);
+	}
+	pthread_cond_signal(&queueCond);
 	pthread_mutex_unlock(&pm);
-	//printf("thread 0x%x go out\n", pthread_self());
 }
 
-void SeqWriter::write(char* str1, char* str2) {
+// called with pm locked, returns the next buffer to write or NULL if there is none
+SeqBuffer* SeqWriter::nextBuffer() {
+	SeqBuffer *buf = NULL;
+	if(ordered) {
+		map<pair<unsigned long, unsigned long>, SeqBuffer*>::iterator it = pending.begin();
+		if(it != pending.end() && it->first.first == headTask && it->first.second == headChunk) {
+			buf = it->second;
+			pending.erase(it);
+			if(buf->last) {
+				runningTasks.erase(headTask);
+				headTask++;
+				headChunk = 0;
+				//a task waiting for a buffer may have become the head
+				pthread_cond_broadcast(&freeCond);
+			}
+			else {
+				headChunk++;
+			}
+		}
+	}
+	else if(!queue.empty()) {
+		buf = queue.front();
+		queue.pop_front();
+	}
+	return buf;
+}
+
+void SeqWriter::writeBuffer(SeqBuffer *buf) {
+	for(int i = 0; i < (pe? 2 : 1); i++) {
+		if(compress) {
+			files[i].write(buf->zdata[i], buf->zlen[i], dropCache);
+		}
+		else {
+			files[i].write(buf->data[i], buf->len[i], dropCache);
+		}
+	}
+	records += buf->records;
+}
+
+void SeqWriter::releaseBuffer(SeqBuffer *buf) {
 	pthread_mutex_lock(&pm);
-	pe_ofs1 << str1;
-	pe_ofs2 << str2;
+	freeBuffers.push_back(buf);
+	pthread_cond_signal(&freeCond);
 	pthread_mutex_unlock(&pm);
 }
 
+void* SeqWriter::run(void *arg) {
+	SeqWriter *sw = (SeqWriter*) arg;
+	SeqBuffer *buf;
+	while(1) {
+		pthread_mutex_lock(&sw->pm);
+		while((buf = sw->nextBuffer()) == NULL && !sw->closing) {
+			pthread_cond_wait(&sw->queueCond, &sw->pm);
+		}
+		pthread_mutex_unlock(&sw->pm);
+		if(buf == NULL) {
+			break;
+		}
+		sw->writeBuffer(buf);
+		sw->releaseBuffer(buf);
+	}
+	return NULL;
+}
+
+//****** write out everything submitted so far and close the files ******//
 void SeqWriter::close() {
-	if(pe){
-		pe_ofs1.close();
-		pe_ofs2.close();
+	pthread_mutex_lock(&pm);
+	if(closing) {
+		pthread_mutex_unlock(&pm);
+		return;
 	}
-	else {
-		se_ofs.close();
+	closing = true;
+	pthread_cond_signal(&queueCond);
+	pthread_mutex_unlock(&pm);
+	pthread_join(writer, NULL);
+	
+	if(!pending.empty()) {
+		cerr << "Error: " << pending.size() << " output chunks were never reached in order!" << endl;
+		exit(-1);
+	}
+	for(int i = 0; i < (pe? 2 : 1); i++) {
+		if(compress) {
+			files[i].write((const char*) BGZF_EOF, sizeof(BGZF_EOF), false);
+		}
+		files[i].close();
 	}
 }
@@ -6,27 +6,151 @@
 #ifndef _SEQWRITER_H
 #define _SEQWRITER_H
 
-#include <fstream>
 #include <string>
+#include <cstring>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <utility>
+#include <sys/types.h>
 #include <pthread.h>
 
 using namespace std;
 
+//****** write v in decimal at p, returns the position after the last digit ******//
+inline char* formatUInt(char *p, unsigned long v) {
+	char tmp[20];
+	int k = 0;
+	do {
+		tmp[k++] = '0'+v%10;
+		v /= 10;
+	} while(v > 0);
+	while(k > 0) {
+		*p++ = tmp[--k];
+	}
+	return p;
+}
+
+// output buffer filled by one worker, data[1] holds mate 2 of paired-end reads,
+// zdata holds the BGZF blocks of data when the output is compressed
+class SeqBuffer {
+	public:
+		char *data[2];
+		size_t len[2];
+		size_t capacity;
+		
+		char *zdata[2];
+		size_t zlen[2];
+		
+		unsigned long task;
+		unsigned long chunk;
+		unsigned long records;
+		bool last;
+		
+		SeqBuffer(size_t capacity, bool pe, bool compress);
+		void compress();
+		~SeqBuffer();
+		
+		size_t space(int i) {return capacity-len[i];}
+		char* end(int i) {return data[i]+len[i];}
+		
+		//append the record "@id1#id2[/mate]" with n bases and qualities to side i, mate 0 adds no suffix
+		inline void appendRecord(int i, unsigned long id1, unsigned long id2, int mate, const char *bases, const char *qualities, int n) {
+			char *p = data[i]+len[i];
+			*p++ = '@';
+			p = formatUInt(p, id1);
+			*p++ = '#';
+			p = formatUInt(p, id2);
+			if(mate > 0) {
+				*p++ = '/';
+				*p++ = '0'+mate;
+			}
+			*p++ = '\n';
+			memcpy(p, bases, n);
+			p += n;
+			*p++ = '\n';
+			*p++ = '+';
+			*p++ = '\n';
+			memcpy(p, qualities, n);
+			p += n;
+			*p++ = '\n';
+			len[i] = p-data[i];
+			records++;
+		}
+};
+
+// a fastq file written with write(2), "-" stands for stdout
+class SeqFile {
+	public:
+		int fd;
+		string name;
+		bool regular;
+		off_t written;
+		off_t synced;
+		
+		void open(string fileName);
+		void write(const char *buf, size_t n, bool dropCache);
+		void close();
+};
+
+// writer stage: workers fill pooled buffers and hand them off, a dedicated thread writes them out.
+// In ordered mode buffers are written by (task, chunk) so the output does not depend on thread timing,
+// a task must then submit its chunks numbered from 0 and mark the final one (possibly empty) as last.
+// A task counts as running from its first getBuffer, which does not depend on the order tasks are scheduled in:
+// getBuffer only blocks while the task the output waits for is running, otherwise it allocates past maxBuffers.
+// Interleaved paired-end output goes to one file, both mates are then appended to data[0].
 class SeqWriter {
 	private:
-		ofstream se_ofs;
-		ofstream pe_ofs1, pe_ofs2;
-		
+		SeqFile files[2];
 		bool pe;
+		bool interleaved;
+		bool ordered;
+		bool dropCache;
+		bool compress;
+		bool closing;
+		unsigned long records;
+		
+		size_t bufferSize;
+		unsigned int maxBuffers;
+		vector<SeqBuffer*> buffers;
+		vector<SeqBuffer*> freeBuffers;
+		
+		deque<SeqBuffer*> queue;
+		map<pair<unsigned long, unsigned long>, SeqBuffer*> pending;
+		unsigned long headTask;
+		unsigned long headChunk;
+		//tasks that got a buffer and whose last chunk is not written yet
+		set<unsigned long> runningTasks;
+		
+		pthread_t writer;
 		pthread_mutex_t pm;
+		pthread_cond_t queueCond;
+		pthread_cond_t freeCond;
 		
-	public:		
-		SeqWriter(string seFile);
-		SeqWriter(string peFile1, string peFile2);
+		void init(bool ordered, unsigned int maxBuffers, size_t bufferSize, bool dropCache, bool compress);
+		SeqBuffer* nextBuffer();
+		void writeBuffer(SeqBuffer *buf);
+		void releaseBuffer(SeqBuffer *buf);
+		static void* run(void *arg);
+		
+	public:
+		SeqWriter(string outFile, bool interleaved, bool ordered, unsigned int maxBuffers, size_t bufferSize, bool dropCache, bool compress);
+		SeqWriter(string peFile1, string peFile2, bool ordered, unsigned int maxBuffers, size_t bufferSize, bool dropCache, bool compress);
 		~SeqWriter();
 		
-		void write(char* str);
-		void write(char* str1, char* str2);
+		bool isPairedEnd() {return pe;}
+		bool isInterleaved() {return interleaved;}
+		//the side of a buffer mate 2 records are appended to
+		int mateSide() {return interleaved? 0 : 1;}
+		string getFileName(int i) {return files[i].name;}
+		//number of records written so far, complete once the writer is closed
+		unsigned long getRecordCount() {return records;}
+		//number of reads so far, a pair of mates counts as one read
+		unsigned long getReadCount() {return isPairedEnd()? records/2 : records;}
+		
+		SeqBuffer* getBuffer(unsigned long task, unsigned long chunk);
+		void submit(SeqBuffer *buf, bool last);
 		
 		void close();
 		
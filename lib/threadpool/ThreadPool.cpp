@@ -3,232 +3,347 @@
 // Health Informatics Lab, University of Science and Technology of China
 // All rights reserved.
 
+#include <fstream>
+#include <map>
+#include <sched.h>
+#include <dirent.h>
+
 #include "ThreadPool.h"
 
+// the worker running on the current thread, NULL outside the pool
+static __thread Thread *currentThread = NULL;
+
+//****** cpus the process may run on, in the order threads are pinned to them ******//
+// cpus are taken from the NUMA nodes in turn, so consecutive threads land on different nodes
+static void getCpuPlacement(vector<int>& cpus, vector<int>& nodes) {
+	vector<int> allowed;
+#ifdef __linux__
+	cpu_set_t cpuset;
+	CPU_ZERO(&cpuset);
+	if(sched_getaffinity(0, sizeof(cpuset), &cpuset) == 0) {
+		for(int i = 0; i < CPU_SETSIZE; i++) {
+			if(CPU_ISSET(i, &cpuset)) {
+				allowed.push_back(i);
+			}
+		}
+	}
+#endif
+	if(allowed.empty()) {
+		int n = sysconf(_SC_NPROCESSORS_ONLN);
+		for(int i = 0; i < n; i++) {
+			allowed.push_back(i);
+		}
+	}
+	
+	//node of every cpu from the cpulists in sysfs, a machine without them is one node
+	map<int, int> cpuNodes;
+	DIR *dir = opendir("/sys/devices/system/node");
+	struct dirent *entry;
+	while(dir != NULL && (entry = readdir(dir)) != NULL) {
+		int node, first, last;
+		if(strncmp(entry->d_name, "node", 4) != 0 || sscanf(entry->d_name+4, "%d", &node) != 1) {
+			continue;
+		}
+		string fileName = string("/sys/devices/system/node/")+entry->d_name+"/cpulist";
+		ifstream ifs(fileName.c_str());
+		string item;
+		while(getline(ifs, item, ',')) {
+			int k = sscanf(item.c_str(), "%d-%d", &first, &last);
+			if(k < 1) {
+				continue;
+			}
+			if(k == 1) {
+				last = first;
+			}
+			for(int i = first; i <= last; i++) {
+				cpuNodes[i] = node;
+			}
+		}
+	}
+	if(dir != NULL) {
+		closedir(dir);
+	}
+	map<int, vector<int> > nodeCpus;
+	for(size_t i = 0; i < allowed.size(); i++) {
+		map<int, int>::iterator it = cpuNodes.find(allowed[i]);
+		nodeCpus[(it == cpuNodes.end())? 0 : it->second].push_back(allowed[i]);
+	}
+	
+	cpus.clear();
+	nodes.clear();
+	for(size_t k = 0; cpus.size() < allowed.size(); k++) {
+		map<int, vector<int> >::iterator it;
+		for(it = nodeCpus.begin(); it != nodeCpus.end(); it++) {
+			if(k < it->second.size()) {
+				cpus.push_back(it->second[k]);
+				nodes.push_back(it->first);
+			}
+		}
+	}
+}
+
+TaskGroup::TaskGroup() {
+	unfinished = 0;
+	pthread_mutex_init(&pm, NULL);
+	pthread_cond_init(&done, NULL);
+}
+
+TaskGroup::~TaskGroup() {
+	pthread_mutex_destroy(&pm);
+	pthread_cond_destroy(&done);
+}
+
+void TaskGroup::finish(long n) {
+	//the count only drops to zero under the mutex, so a waiter cannot see the group done
+	//and destroy it while the last finisher still uses the mutex or the condition
+	long left = unfinished;
+	while(left > n) {
+		if(unfinished.compare_exchange_weak(left, left-n)) {
+			return;
+		}
+	}
+	pthread_mutex_lock(&pm);
+	if((unfinished -= n) == 0) {
+		pthread_cond_broadcast(&done);
+	}
+	pthread_mutex_unlock(&pm);
+}
+
+void TaskGroup::wait() {
+	pthread_mutex_lock(&pm);
+	while(unfinished > 0) {
+		pthread_cond_wait(&done, &pm);
+	}
+	pthread_mutex_unlock(&pm);
+}
+
 void ThreadPool::pool_init() {
-	pthread_mutex_init(&work_lock, NULL); 
+	pthread_mutex_init(&work_lock, NULL);
 	pthread_cond_init(&work_ready, NULL);
+	pthread_mutex_init(&free_lock, NULL);
+	nextThread = 0;
 	cur_queue_size = 0;
 	finishedWorks = 0;
+	sleepers = 0;
 	shutdown = false;
-	work_list = (work_queue*) malloc(sizeof(work_queue));
-	work_list->next = NULL;
-	rear = work_list;
-
-	int thread_num = sysconf(_SC_NPROCESSORS_CONF);
+	
+	//only the cpus of the process's cpuset are used, e.g. inside containers and cgroup-limited jobs
+	vector<int> cpus, nodes;
+	getCpuPlacement(cpus, nodes);
+	int thread_num = cpus.size();
 	//cerr << "number of threads: " << thread_num << endl;
-
+	
 	max_thread_num = min(max_thread_num, thread_num);
-
+	
 	cerr << "\nnumber of available threads: " << thread_num << endl;
 	cerr << "number of requested threads: " << max_thread_num << endl << endl;
-
-	for(size_t i = 0; i < max_thread_num; i++) {
-		Thread* thread = new Thread();
+	
+	//all queues exist before any worker starts taking works from them
+	for(int i = 0; i < max_thread_num; i++) {
+		thread_list.push_back(new Thread(this, i, cpus[i%thread_num], nodes[i%thread_num]));
+	}
+	for(int i = 0; i < max_thread_num; i++) {
+		Thread* thread = thread_list[i];
 		
-		pthread_create(thread->getThreadEntrance(), NULL, threadFun, this);
-		thread_list.push_back(thread);
+		pthread_create(thread->getThreadEntrance(), NULL, threadFun, thread);
 		
 		#ifdef __linux__
 			cpu_set_t cpuset;
 			CPU_ZERO(&cpuset);
-			CPU_SET(i, &cpuset);
+			CPU_SET(thread->getCpu(), &cpuset);
 			if (pthread_setaffinity_np(thread->getThreadId(), sizeof(cpuset), &cpuset) < 0) {
 				cerr << "set thread affinity failed." << endl;
 			}
 		#endif
-		
-		unsigned seed = chrono::system_clock::now().time_since_epoch().count();
-		mt19937 generator(seed);
-		//default_random_engine generator(seed);
-		minRandNumber = generator.min();
-		maxRandNumber = generator.max();
-		realGenerators.insert(pair<pthread_t, mt19937>(thread->getThreadId(), generator));
-		intGenerators.insert(pair<pthread_t, mt19937>(thread->getThreadId(), generator));
-		//realGenerators.insert(pair<pthread_t, default_random_engine>(thread->getThreadId(), generator));
-		//intGenerators.insert(pair<pthread_t, default_random_engine>(thread->getThreadId(), generator));
 	}
 }
 
 void ThreadPool::pool_destroy() {
-	if(thread_list.size() == 0 && work_list == NULL) {
+	if(thread_list.size() == 0) {
 		return;
 	}
+	pthread_mutex_lock(&work_lock);
 	shutdown = true;
 	pthread_cond_broadcast(&work_ready);
+	pthread_mutex_unlock(&work_lock);
 	
-	for(size_t i = 0; i < max_thread_num; i++) {
+	for(size_t i = 0; i < thread_list.size(); i++) {
 		pthread_join(thread_list[i]->getThreadId(), NULL);
 	}
 	
+	clearWorks();
 	std::vector<Thread*>::iterator it, it_e = thread_list.end();
 	for(it = thread_list.begin(); it != it_e; it++) {
 		delete *it;
 	}
 	thread_list.clear();
 	
-	work_queue *q,*p = work_list->next;
-	while(p) {
-		q = p->next;
-		delete p->work;
-		free(p);
-		p = q;
-	}
-	free(work_list);
-	work_list = NULL;
-	rear = NULL;
+	for(size_t i = 0; i < freeWorks.size(); i++) {
+		delete freeWorks[i];
+	}
+	freeWorks.clear();
 	
-	pthread_mutex_destroy(&work_lock);  
+	pthread_mutex_destroy(&work_lock);
 	pthread_cond_destroy(&work_ready);
-	
+	pthread_mutex_destroy(&free_lock);
 }
 
-void ThreadPool::pool_add_work(void *(*process) (const void *arg), const void *arg, int wid) {					
-	Work *newwork = new Work(process, arg, wid);
-	
-	work_queue *p = (work_queue*) malloc(sizeof(work_queue));
-	p->work = newwork;
-	p->next = NULL;
-	
-	pthread_mutex_lock(&work_lock);
-	rear->next = p;
-	rear = p;
+Work* ThreadPool::newWork() {
+	Work *work = NULL;
+	pthread_mutex_lock(&free_lock);
+	if(!freeWorks.empty()) {
+		work = freeWorks.back();
+		freeWorks.pop_back();
+	}
+	pthread_mutex_unlock(&free_lock);
+	if(work == NULL) {
+		work = new Work();
+	}
+	return work;
+}
+
+void ThreadPool::releaseWork(Work *work) {
+	pthread_mutex_lock(&free_lock);
+	freeWorks.push_back(work);
+	pthread_mutex_unlock(&free_lock);
+}
+
+void ThreadPool::pool_add_work(void *(*process) (const void *arg), const void *arg, int wid) {
+	pool_add_work(process, arg, wid, &group);
+}
+
+void ThreadPool::pool_add_work(void *(*process) (const void *arg), const void *arg, int wid, TaskGroup *group) {
+	Work *newwork = newWork();
+	newwork->process = process;
+	newwork->arg = arg;
+	newwork->wid = wid;
+	newwork->group = group;
+	group->add(1);
 	
-	assert(work_list->next != NULL);
+	//works added by a worker go to its own deque, a negative wid deals the work round-robin
+	Thread *thread = currentThread;
+	bool spawned = (thread != NULL && thread->pool == this);
+	if(!spawned) {
+		unsigned long k = (wid >= 0)? wid : nextThread++;
+		thread = thread_list[k % thread_list.size()];
+	}
+	pthread_mutex_lock(&thread->pm);
+	if(spawned) {
+		thread->spawned.push_back(newwork);
+	}
+	else {
+		thread->works.push_back(newwork);
+	}
+	thread->queued++;
+	pthread_mutex_unlock(&thread->pm);
 	
+	//a worker counts itself as sleeper before it checks the queue size, so either it sees this work
+	//or it is seen here and woken under the lock
 	cur_queue_size++;
-	
-	pthread_mutex_unlock(&work_lock);
-	pthread_cond_signal(&work_ready);
+	if(sleepers > 0) {
+		pthread_mutex_lock(&work_lock);
+		pthread_cond_signal(&work_ready);
+		pthread_mutex_unlock(&work_lock);
+	}
 }
 
-void ThreadPool::thread_routine() {
-	//printf("starting thread 0x%x\n", pthread_self());
-	while(1) {
-		pthread_mutex_lock(&work_lock);
-		while(cur_queue_size == 0) {
-			//printf("thread 0x%x is waiting\n", pthread_self());
-			if(shutdown) {
-				pthread_mutex_unlock(&work_lock);
-				pthread_exit(NULL);
-			}
-			pthread_cond_wait(&work_ready, &work_lock);
+//****** take the newest work of the own deque or the oldest of the own inbox, otherwise steal the oldest work of another worker ******//
+Work* ThreadPool::takeWork(int self) {
+	size_t n = thread_list.size();
+	for(size_t k = 0; k < n; k++) {
+		Thread *thread = thread_list[(self+k)%n];
+		if(thread->queued <= 0) {
+			continue;
 		}
-		
-		assert(cur_queue_size != 0);
-		assert(work_list->next != NULL);
-		
-		size_t i, j;
-		for(i = 0; i < thread_list.size(); i++) {
-			if(thread_list[i]->getThreadId() == pthread_self()) {
-				thread_list[i]->Start();
-				break;
-			}
+		Work *work = NULL;
+		pthread_mutex_lock(&thread->pm);
+		if(k == 0 && !thread->spawned.empty()) {
+			work = thread->spawned.back();
+			thread->spawned.pop_back();
 		}
-		
-		work_queue *q = work_list, *p;
-		p = q->next;
-		while(p) {
-			if(p->work->IsReady()) {
+		else if(!thread->works.empty()) {
+			work = thread->works.front();
+			thread->works.pop_front();
+		}
+		else if(!thread->spawned.empty()) {
+			work = thread->spawned.front();
+			thread->spawned.pop_front();
+		}
+		if(work != NULL) {
+			thread->queued--;
+		}
+		pthread_mutex_unlock(&thread->pm);
+		if(work != NULL) {
+			cur_queue_size--;
+			return work;
+		}
+	}
+	return NULL;
+}
+
+void ThreadPool::thread_routine(Thread *thread) {
+	currentThread = thread;
+	while(1) {
+		Work *work = takeWork(thread->index);
+		if(work == NULL) {
+			pthread_mutex_lock(&work_lock);
+			sleepers++;
+			while(cur_queue_size <= 0 && !shutdown) {
+				pthread_cond_wait(&work_ready, &work_lock);
+			}
+			sleepers--;
+			bool stop = shutdown && cur_queue_size <= 0;
+			pthread_mutex_unlock(&work_lock);
+			if(stop) {
 				break;
 			}
-			q = p;
-			p = p->next;
-		}
-		
-		assert(p != NULL);
-		
-		cur_queue_size--;
-		q->next = p->next;
-		if(rear == p) {
-			rear = q;
+			continue;
 		}
 		
-		pthread_mutex_unlock(&work_lock);
-		
-		//printf("thread 0x%x is starting to work\n", pthread_self());
-		p->work->StartProcess(pthread_self());
-		p->work->run();
-		
-		thread_list[i]->Finish();
-		p->work->FinishProcess();
-		long long tv_usec = p->work->ElapsedTime();
-		int wid = p->work->getWorkId();
-		
-		delete p->work;
-		free(p);
-		p = NULL;
+		work->run();
 		
+		TaskGroup *group = work->group;
+		releaseWork(work);
 		finishedWorks++;
-		
-		
-		//printf("work %d is finished in %d seconds by thread 0x%x\n", wid, tv_usec/1000000, pthread_self());
-		
+		group->finish(1);
 	}
+	currentThread = NULL;
 }
 
+//****** drop the works that have not started yet ******//
 void ThreadPool::clearWorks() {
-	pthread_mutex_lock(&work_lock);
-	
-	work_queue *q, *p = work_list->next;
-	while(p) {
-		q = p->next;
-		delete p->work;
-		free(p);
-		p = q;
-	}
-	work_list->next = NULL;
-	cur_queue_size = 0;
-	finishedWorks = 0;
-	pthread_mutex_unlock(&work_lock);
-}
-
-void ThreadPool::wait() {
-	while(1) {
-		if(cur_queue_size == 0) {
-			std::vector<Thread*>::iterator it;
-			for(it = thread_list.begin(); it != thread_list.end(); it++) {
-				if((*it)->IsBusy()) {
-					break;
-				}
-			}
-			if(it == thread_list.end()) {
-				break;
+	for(size_t i = 0; i < thread_list.size(); i++) {
+		Thread *thread = thread_list[i];
+		pthread_mutex_lock(&thread->pm);
+		for(int q = 0; q < 2; q++) {
+			deque<Work*>& works = (q == 0)? thread->works : thread->spawned;
+			while(!works.empty()) {
+				Work *work = works.front();
+				works.pop_front();
+				thread->queued--;
+				cur_queue_size--;
+				work->group->finish(1);
+				releaseWork(work);
 			}
 		}
-		usleep(50000);
+		pthread_mutex_unlock(&thread->pm);
 	}
+	finishedWorks = 0;
 }
 
-double ThreadPool::randomDouble(double start, double end) {
-	pthread_t tid = pthread_self();
-	double number = realGenerators[tid]();
-	return start+(end-start)*((number-minRandNumber)/(maxRandNumber-minRandNumber+1.0));
+int ThreadPool::getNodeNumber() {
+	int n = 0;
+	for(size_t i = 0; i < thread_list.size(); i++) {
+		n = max(n, thread_list[i]->getNode()+1);
+	}
+	return n;
 }
-long ThreadPool::randomInteger(long start, long end) {
-	pthread_t tid = pthread_self();
-	double number = intGenerators[tid]();
-	return start+(end-start)*((number-minRandNumber)/(maxRandNumber-minRandNumber+1.0));
+
+void ThreadPool::wait() {
+	group.wait();
 }
 
 ThreadPool::~ThreadPool() {
-	std::vector<Thread*>::iterator it, it_e = thread_list.end();
-	for(it = thread_list.begin(); it != it_e; it++) {
-		delete *it;
-	}
-	thread_list.clear();
-
-	work_queue *p = work_list->next;
-	while(work_list) {
-		delete work_list->work;
-		free(work_list);
-		work_list = p;
-		p = work_list->next;
-	}
-
-	pthread_mutex_destroy(&work_lock);  
-	pthread_cond_destroy(&work_ready);
+	pool_destroy();
 }
 
-
-
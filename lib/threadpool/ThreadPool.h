@@ -10,63 +10,34 @@
 #include <cstdio>
 #include <cstdlib>
 #include <vector>
-#include <map>
+#include <deque>
+#include <atomic>
 #include <cerrno>
 #include <cassert>
 #include <cstring>
-#include <chrono>
-#include <random>
 #include <unistd.h>
-#include <sys/time.h>
 #include <pthread.h>
 
 using namespace std;
 
+class ThreadPool;
 
-class Thread {
+// a set of works that can be joined
+class TaskGroup {
 	private:
-		pthread_t tid;
-
-		enum ThreadState {
-			FREE = 0,
-			BUSY = 1
-		};
-		mutable pthread_mutex_t pm;
-		ThreadState state;
+		atomic<long> unfinished;
+		pthread_mutex_t pm;
+		pthread_cond_t done;
 	public:
-		Thread() {
-			state = FREE;
-			tid = pthread_self();
-			pthread_mutex_init(&pm, NULL);
-		}
+		TaskGroup();
+		~TaskGroup();
 		
-		bool IsBusy() {return state == BUSY;}
-		
-		void Start() {
-			pthread_mutex_lock(&pm);
-			state = BUSY;
-			pthread_mutex_unlock(&pm);
-		}
-		
-		void Finish() {
-			pthread_mutex_lock(&pm);
-			state = FREE;
-			pthread_mutex_unlock(&pm);
-		}
-		
-		bool waitFinished() {
-			usleep(50000);
-			pthread_mutex_lock(&pm);
-			if(state == FREE) {
-				pthread_mutex_unlock(&pm);
-				return true;
-			}
-			pthread_mutex_unlock(&pm);
-			return false;
-		}
+		void add(long n) {unfinished += n;}
+		void finish(long n);
 		
-		pthread_t getThreadId() const {return tid;}
-		pthread_t* getThreadEntrance() {return &tid;}
+		//blocks until every work added to the group has finished, only wait() makes it safe to destroy the group
+		void wait();
+		bool finished() {return unfinished == 0;}
 };
 
 class Work {
@@ -74,107 +45,93 @@ class Work {
 		void* (*process) (const void* arg);
 		const void* arg;
 		int wid;
-		pthread_t tid;
+		TaskGroup *group;
 		
-		enum WorkState {
-			READY = 0,
-			UNDER_PROCESS = 1,
-			FINISHED = 2
-		};
+		friend class ThreadPool;
+	public:
+		int getWorkId() const {return wid;}
 		
-		WorkState state;
+		void run() {(*process)(arg);}
+};
+
+// a worker thread, the cpu and NUMA node it runs on and the works queued for it
+class Thread {
+	private:
+		pthread_t tid;
+		int index;
+		int cpu;
+		int node;
+		ThreadPool *pool;
+		
+		//works added from outside the pool, oldest first for everyone
+		deque<Work*> works;
+		//works added by this worker, its newest first for itself and oldest first for the others
+		deque<Work*> spawned;
+		//works in both queues, read without the lock to skip empty queues
+		atomic<long> queued;
 		mutable pthread_mutex_t pm;
-		struct timeval tv_started;
-		struct timeval tv_finished;
+		
+		friend class ThreadPool;
 	public:
-		Work(void* (*process) (const void* arg), const void* arg, int wid) : process(process), arg(arg), wid(wid) {
-			state = READY;
-			//tid = 0;
-			memset(&tv_started, 0, sizeof(tv_started));
-			memset(&tv_finished, 0, sizeof(tv_finished));
+		Thread(ThreadPool *pool, int index, int cpu, int node) : index(index), cpu(cpu), node(node), pool(pool) {
+			tid = pthread_self();
+			queued = 0;
 			pthread_mutex_init(&pm, NULL);
 		}
 		
-		bool IsReady() {
-			return state == READY;
-		}
-		
-		bool IsUnderProcess() {
-			return state == UNDER_PROCESS;
-		}
-		
-		bool IsFinished() {
-			return state == FINISHED;
-		}
-		
-		void StartProcess(pthread_t tid) {
-			pthread_mutex_lock(&pm);
-			this->tid = tid;
-			gettimeofday(&tv_started, NULL);
-			state = UNDER_PROCESS;
-			pthread_mutex_unlock(&pm);
-		}
-		
-		void FinishProcess() {
-			pthread_mutex_lock(&pm);
-			gettimeofday(&tv_finished, NULL);
-			state = FINISHED;
-			pthread_mutex_unlock(&pm);
-		}
-		
-		long long ElapsedTime() const {
-			pthread_mutex_lock(&pm);
-			long long tv_usec;
-			if(state == FINISHED) {
-				tv_usec = (unsigned long long) (tv_finished.tv_sec-tv_started.tv_sec)*1000000 + (tv_finished.tv_usec - tv_started.tv_usec);
-			}
-			else {
-				tv_usec = -1;
-			}
-			pthread_mutex_unlock(&pm);
-			return tv_usec;
+		~Thread() {
+			pthread_mutex_destroy(&pm);
 		}
 		
-		int getWorkId() const {return wid;}
-		
-		void run() {(*process)(arg);}
+		pthread_t getThreadId() const {return tid;}
+		pthread_t* getThreadEntrance() {return &tid;}
+		int getCpu() const {return cpu;}
+		int getNode() const {return node;}
 };
 
-typedef struct queue {
-	Work *work;
-	struct queue *next;
-}work_queue;
-
+// Work-stealing pool: every worker owns a deque of the works it added itself, which it pops newest first while
+// the others steal from the oldest end, and an inbox of the works added from outside the pool. A work added from
+// outside goes to the inbox of worker wid%threads, so works touching the same data can be sent to the same worker.
+// Inboxes are served oldest first by their owner and by thieves alike, so a batch of works added with consecutive
+// wids starts roughly in order (the ordered mode of SeqWriter then stays within its buffer limit, it does not
+// depend on this to make progress). A worker that runs dry steals, first from the inboxes, then from the deques.
+// Workers are pinned to the cpus the process may run on, spread over the NUMA nodes.
 class ThreadPool {
 	private:
 		int max_thread_num;
 		
 		vector<Thread*> thread_list;
-		work_queue *work_list;
-		work_queue *rear;
-		int cur_queue_size;
-		int finishedWorks;
+		atomic<unsigned long> nextThread;
+		atomic<long> cur_queue_size;
+		atomic<int> finishedWorks;
+		//workers about to wait for works, an add only takes work_lock to wake one of them
+		atomic<int> sleepers;
 		bool shutdown;
 		
 		pthread_mutex_t work_lock;
 		pthread_cond_t work_ready;
 		
-		long minRandNumber, maxRandNumber;
-		map<pthread_t, mt19937> realGenerators;
-		map<pthread_t, mt19937> intGenerators;
-		//map<pthread_t, default_random_engine> realGenerators;
-		//map<pthread_t, default_random_engine> intGenerators;
+		//finished works are kept for reuse
+		vector<Work*> freeWorks;
+		pthread_mutex_t free_lock;
 		
-		void thread_routine();
+		TaskGroup group;
+		
+		Work* newWork();
+		void releaseWork(Work *work);
+		Work* takeWork(int self);
+		
+		void thread_routine(Thread *thread);
 		static void* threadFun(void *object) {
-			((ThreadPool *)object)->thread_routine();
+			Thread *thread = (Thread*) object;
+			thread->pool->thread_routine(thread);
 			return NULL;
 		}
-		
+	
 	public:
 		ThreadPool(int max_thread_num) : max_thread_num(max_thread_num) {}
 		
-		ThreadPool() {	
+		ThreadPool() {
 			max_thread_num = 1;
 		}
 		
@@ -183,24 +140,24 @@ class ThreadPool {
 		}
 		
 		int getThreadNumber() {return max_thread_num;}
+		int getNodeNumber();
 		
 		~ThreadPool();
 		
 		int worksFinished() {return finishedWorks;}
 		
-		void pool_init();	
+		void pool_init();
 		
 		void pool_destroy();
 		
 		void clearWorks();
 		
 		void pool_add_work(void *(*process) (const void *arg), const void *arg, int wid);
+		void pool_add_work(void *(*process) (const void *arg), const void *arg, int wid, TaskGroup *group);
 		
+		//wait for all works added without a group
 		void wait();
-		
-		double randomDouble(double start, double end);
-		long randomInteger(long start, long end);
-		
+
 };
 
 #endif
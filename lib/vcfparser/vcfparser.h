@@ -42,7 +42,7 @@ class Insert {
 		Insert(long position, string sequence, varType type) :
 			position(position), sequence(sequence), type(type) {}
 		long getPosition() {return position;}
-		string getSequence() {return sequence;}
+		const string& getSequence() {return sequence;}
 		int getLength() {return sequence.length();}
 		varType getType() {return type;}
 	private:
@@ -31,6 +31,10 @@ int main(int argc, char *argv[]) {
 	string subcmd = argv[1];
 	
 	if(subcmd.compare("simuvars") == 0) {
+		/*** create thread pool ***/
+		threadPool = new ThreadPool(config.getIntPara("threads"));
+		threadPool->pool_init();
+		
 		/*** load data ***/
 		genome.loadData();
 		/*** create and save sequences ***/
@@ -44,7 +48,12 @@ int main(int argc, char *argv[]) {
 		profile.train();
 	}
 	else { // genreads
-		srand(start_t);
+		long seed = config.getIntPara("seed");
+		if(seed < 0) {
+			seed = start_t;
+		}
+		RandomEngine::setBaseSeed(seed);
+		cerr << "random seed: " << seed << endl;
 		/*** create thread pool ***/
 		threadPool = new ThreadPool(config.getIntPara("threads"));
 		threadPool->pool_init();
@@ -108,6 +117,7 @@ void parseArgs(int argc, char *argv[]) {
 void parseArgs_simuVars(int argc, char *argv[]) {
 	string refFile = "", snpFile = "";
 	string varFile = "", outFile = "";
+	int threads = 1;
 
 	struct option long_options[] = {
 		{"help", no_argument, 0, 'h'},
@@ -115,12 +125,13 @@ void parseArgs_simuVars(int argc, char *argv[]) {
 		{"snp", required_argument, 0, 's'},
 		{"var", required_argument, 0, 'v'},
 		{"output", required_argument, 0, 'o'},
+		{"threads", required_argument, 0, 't'},
 		{0, 0, 0, 0}
 	};
 
 	int c;
 	//Parse command line parameters
-	while((c = getopt_long(argc, argv, "hr:s:v:o:", long_options, NULL)) != -1){
+	while((c = getopt_long(argc, argv, "hr:s:v:o:t:", long_options, NULL)) != -1){
 		switch(c){
 			case 'h':
 				usage_simuVars(argv[0]);
@@ -137,6 +148,9 @@ void parseArgs_simuVars(int argc, char *argv[]) {
 			case 'o':
 				outFile = optarg;
 				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
 			default :
 				usage_simuVars(argv[0]);
 				exit(1);
@@ -165,10 +179,16 @@ void parseArgs_simuVars(int argc, char *argv[]) {
 		exit(1);
 	}
 	
+	if(threads < 1) {
+		cerr << "Error: number of threads should be a positive integer!" << endl;
+		exit(1);
+	}
+	
 	config.setStringPara("ref", refFile);
 	config.setStringPara("snp", snpFile);
 	config.setStringPara("var", varFile);
 	config.setStringPara("output", outFile);
+	config.setIntPara("threads", threads);
 }
 
 void parseArgs_learnProfile(int argc, char *argv[]) {
@@ -291,6 +311,8 @@ void parseArgs_genReads(int argc, char *argv[]) {
 	
 	int threads = 1, isize = 260;
 	double coverage = 5;
+	long seed = -1;
+	int ordered = 0, dropCache = 0, compress = 0, interleaved = 0, shards = 1;
 	
 	struct option long_options[] = {
 		{"help", no_argument, 0, 'h'},
@@ -303,12 +325,18 @@ void parseArgs_genReads(int argc, char *argv[]) {
 		{"isize", required_argument, 0, 's'},
 		{"threads", required_argument, 0, 't'},
 		{"output", required_argument, 0, 'o'},
+		{"seed", required_argument, 0, 'S'},
+		{"ordered", no_argument, 0, 'O'},
+		{"drop-cache", no_argument, 0, 'D'},
+		{"compress", no_argument, 0, 'z'},
+		{"interleaved", no_argument, 0, 'I'},
+		{"shards", required_argument, 0, 'n'},
 		{0, 0, 0, 0}
 	};
 
 	int c;
 	//Parse command line parameters
-	while((c = getopt_long(argc, argv, "hi:p:r:m:l:c:s:t:o:", long_options, NULL)) != -1){
+	while((c = getopt_long(argc, argv, "hi:p:r:m:l:c:s:t:o:S:ODzIn:", long_options, NULL)) != -1){
 		switch(c){
 			case 'h':
 				usage_genReads(argv[0]);
@@ -340,6 +368,28 @@ void parseArgs_genReads(int argc, char *argv[]) {
 			case 'o':
 				outputPrefix = optarg;
 				break;
+			case 'S':
+				seed = atol(optarg);
+				if(seed < 0) {
+					cerr << "Error: random seed should be a non-negative integer!" << endl;
+					exit(1);
+				}
+				break;
+			case 'O':
+				ordered = 1;
+				break;
+			case 'D':
+				dropCache = 1;
+				break;
+			case 'z':
+				compress = 1;
+				break;
+			case 'I':
+				interleaved = 1;
+				break;
+			case 'n':
+				shards = atoi(optarg);
+				break;
 			default :
 				usage_genReads(argv[0]);
 				exit(1);
@@ -391,6 +441,14 @@ void parseArgs_genReads(int argc, char *argv[]) {
 		cerr << "Error: number of threads should be a positive integer!" << endl;
 		exit(1);
 	}
+	if(shards < 1) {
+		cerr << "Error: number of shards should be a positive integer!" << endl;
+		exit(1);
+	}
+	if(shards > 1 && outputPrefix.compare("-") == 0) {
+		cerr << "Error: sharded output can not be written to stdout!" << endl;
+		exit(1);
+	}
 	
 	config.setStringPara("ref", inputFile);
 	config.setStringPara("profile", modelFile);
@@ -401,6 +459,12 @@ void parseArgs_genReads(int argc, char *argv[]) {
 	config.setRealPara("coverage", coverage);
 	config.setIntPara("isize", isize);
 	config.setIntPara("threads", threads);
+	config.setIntPara("seed", seed);
+	config.setIntPara("ordered", ordered);
+	config.setIntPara("dropCache", dropCache);
+	config.setIntPara("compress", compress);
+	config.setIntPara("interleaved", interleaved);
+	config.setIntPara("shards", shards);
 }
 
 void usage(const char* app) {
@@ -428,6 +492,7 @@ void usage_simuVars(const char* app) {
 		<< "    -s, --snp <string>              SNP file containing the SNPs to be simulated [Default:null]" << endl
 		<< "    -v, --var <string>              variation file containing the genomic variations to be simulated [Default:null]" << endl
 		<< "    -o, --output <string>           output file (.fasta) to save generated sequences" << endl
+		<< "    -t, --threads <int>             number of threads to use, chromosomes are simulated in parallel [Default:1]" << endl
 		<< endl
 		<< "Example:" << endl
 		<< "    scssim " << app << " -r /path/to/hg19.fa -s /path/to/hg19.snp138.1based.txt -v /path/to/variation.txt -o /path/to/results.fa" << endl
@@ -476,7 +541,13 @@ void usage_genReads(const char* app) {
 		<< "    -c, --coverage <float>          sequencing coverage [Default:5]" << endl
 		<< "    -s, --isize <int>               mean insert size for paired-end sequencing [Default:260]" << endl
 		<< "    -t, --threads <int>             number of threads to use [Default:1]" << endl
-		<< "    -o, --output <string>           the prefix of output file" << endl
+		<< "    -o, --output <string>           the prefix of output file, \"-\" writes the reads to stdout (paired-end reads interleaved)" << endl
+		<< "    -S, --seed <int>                seed of the random number generator, the same seed gives the same reads for any number of threads [Default:current time]" << endl
+		<< "    -O, --ordered                   write reads in amplicon order, with --seed the output files do not depend on the number of threads" << endl
+		<< "    -D, --drop-cache                drop written output from the page cache" << endl
+		<< "    -z, --compress                  write BGZF-compressed fastq files (.fq.gz), compressed by the worker threads" << endl
+		<< "    -I, --interleaved               write paired-end reads interleaved to one file (.fq), e.g. a named pipe read by an aligner" << endl
+		<< "    -n, --shards <int>              split the reads by amplicon range into <int> independent file sets (<prefix>_shard<k>), listed in <prefix>.manifest [Default:1]" << endl
 		<< endl
 		<< "Example:" << endl
 		<< "    scssim " << app << " -i /path/to/ref.fa -m /path/to/hiseq2500.profile -t 5 -o /path/to/reads" << endl